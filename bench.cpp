@@ -0,0 +1,922 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "entities.h"
+#include "linear.h"
+#include "orthtree.h"
+#include "quadtree.h"
+#include "quadtree.inl"
+#include "snapshot.h"
+
+using namespace std;
+
+// Builds the same clustered point set at several leaf capacities and reports
+// the shape of the resulting tree and the cost of rectangle queries on it.
+// Capacity 1 is the old one-entity-per-leaf layout. The last rows are the
+// Morton-sorted LinearQuadTree and the fixed-point descent (FixedQuadTree,
+// capacity 4) on the same data. After the table come the
+// specialised queries, each next to the find-based way of emulating it, a
+// read-only snapshot of the tree, bulk builds from the sorted point set,
+// repairing against rebuilding a moving tree, the same motion in an
+// EntityStore, moving entities by handle, inserts from several threads at
+// once, and an octree over the points lifted into 3D.
+//
+// Every row that has a reference to compare against is checked too, as are
+// the tree invariants after each kind of mutation. A mismatch prints FAILED
+// and makes the run exit with 1.
+//
+// usage: quad_bench [points] [queries] [seed]
+
+using Clock = chrono::steady_clock;
+
+static f64 ms(Clock::duration d) {
+  return chrono::duration<f64, milli>(d).count();
+}
+
+// The capacity table tries several capacities on one instantiation.
+struct TunablePolicy : TreePolicy {
+  static constexpr bool TUNABLE = true;
+};
+using TunableQuadTree = BasicQuadTree<TreeNode, TunablePolicy>;
+
+
+static bool failed = false;
+
+static void expect(bool ok, const char* what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    failed = true;
+  }
+}
+
+// Same cells all the way down, and the same positions in every leaf in any
+// order.
+template <class Tree>
+static bool same(Tree& a, Tree& b) {
+  if (a.total != b.total || !a.split() != !b.split())
+    return false;
+  if (auto c = a.split()) {
+    for (int i = 0; i < 4; i++)
+      if (!same((*c)[i], (*b.split())[i]))
+        return false;
+    return true;
+  }
+  vector<pair<f32, f32>> pa, pb;
+  for (auto& e : a.items)
+    pa.push_back({e.pos.x, e.pos.y});
+  for (auto& e : b.items)
+    pb.push_back({e.pos.x, e.pos.y});
+  sort(pa.begin(), pa.end());
+  sort(pb.begin(), pb.end());
+  return pa == pb;
+}
+
+// The most entities any leaf holds.
+template <class Tree>
+static u32 max_leaf(Tree& t) {
+  u32 m = t.items.size();
+  if (auto c = t.split())
+    for (auto& c : *c)
+      m = std::max(m, max_leaf(c));
+  return m;
+}
+
+static vector<TreeNode> clustered(int n, mt19937& rng) {
+  uniform_real_distribution<f32> unit(-1.f, 1.f);
+  normal_distribution<f32> spread(0.f, 1.f);
+
+  vector<TreeNode> v;
+  v.reserve(n);
+  vec2 centre = {};
+  f32 radius = 0;
+  for (int i = 0; i < n; i++) {
+    if (i % 1024 == 0) {
+      centre = vec2{unit(rng), unit(rng)} * 512.f;
+      radius = exp2f(unit(rng) * 8.f - 6.f);
+    }
+    v.push_back({centre + vec2{spread(rng), spread(rng)} * radius, {}});
+  }
+  return v;
+}
+
+int main(int argc, char** argv) {
+  const int points = argc > 1 ? atoi(argv[1]) : 200000;
+  const int queries = argc > 2 ? atoi(argv[2]) : 20000;
+  const u32 seed = argc > 3 ? atoi(argv[3]) : 1;
+
+  mt19937 rng(seed);
+  const vector<TreeNode> pts = clustered(points, rng);
+
+  uniform_int_distribution<int> pick(0, points - 1);
+  uniform_real_distribution<f32> size(0.f, 8.f);
+  vector<Rect> rects;
+  for (int i = 0; i < queries; i++) {
+    f32 s = exp2f(size(rng) - 6.f);
+    rects.push_back({pts[pick(rng)].pos, {s, s}});
+  }
+
+  printf("%d points, %d queries\n", points, queries);
+  printf("%8s %10s %6s %10s %10s %12s %12s %12s %10s\n", "capacity",
+         "entities", "depth", "nodes", "build ms", "find ms", "query() ms",
+         "count() ms", "hits");
+
+  u64 reference = 0;
+  for (u32 cap : {1, 2, 4, 8, 16, 32}) {
+    TunableQuadTree::leaf_capacity = cap;
+
+    auto t0 = Clock::now();
+    TunableQuadTree* tree = new TunableQuadTree{};
+    vector<TreeNode> out;
+    for (auto& p : pts)
+      tree->insert(p, out);
+
+    auto t1 = Clock::now();
+    vector<TreeNode*> hits;
+    u64 total = 0;
+    int counter = 0;
+    for (auto& r : rects) {
+      hits.clear();
+      tree->find(r, hits, counter);
+      total += hits.size();
+    }
+
+    auto t2 = Clock::now();
+    u64 visited = 0;
+    for (auto& r : rects)
+      tree->query(r, [&](TreeNode&) { visited++; });
+
+    auto t3 = Clock::now();
+    u64 counted = 0;
+    for (auto& r : rects)
+      counted += tree->count(r);
+
+    auto t4 = Clock::now();
+    printf("%8u %10u %6d %10d %10.3f %12.3f %12.3f %12.3f %10llu\n", cap,
+           tree->count(), tree->depth(), tree->size(), ms(t1 - t0),
+           ms(t2 - t1), ms(t3 - t2), ms(t4 - t3), (unsigned long long)total);
+    if (visited != total || counted != total)
+      printf("query() saw %llu entities, count() %llu, find %llu\n",
+             (unsigned long long)visited, (unsigned long long)counted,
+             (unsigned long long)total);
+    expect(visited == total && counted == total, "query() and count()");
+    expect(tree->check(), "tree invariants after insert");
+    expect(!reference || total == reference, "hits across capacities");
+    reference = total;
+    delete tree;
+  }
+
+  {
+    auto t0 = Clock::now();
+    LinearQuadTree* tree = new LinearQuadTree{};
+    vector<TreeNode> out;
+    for (auto& p : pts)
+      tree->insert(p, out);
+    tree->flush();
+
+    auto t1 = Clock::now();
+    vector<TreeNode*> hits;
+    u64 total = 0;
+    int counter = 0;
+    for (auto& r : rects) {
+      hits.clear();
+      tree->find(r, hits, counter);
+      total += hits.size();
+    }
+
+    auto t2 = Clock::now();
+    printf("%8s %10zu %6s %10s %10.3f %12.3f %12s %12s %10llu\n", "linear",
+           tree->items.size(), "-", "-", ms(t1 - t0), ms(t2 - t1), "-", "-",
+           (unsigned long long)total);
+    expect(total == reference, "linear hits");
+    delete tree;
+  }
+
+  {
+    auto t0 = Clock::now();
+    FixedQuadTree* tree = new FixedQuadTree{};
+    vector<TreeNode> out;
+    for (auto& p : pts)
+      tree->insert(p, out);
+
+    auto t1 = Clock::now();
+    vector<TreeNode*> hits;
+    u64 total = 0;
+    int counter = 0;
+    for (auto& r : rects) {
+      hits.clear();
+      tree->find(r, hits, counter);
+      total += hits.size();
+    }
+
+    auto t2 = Clock::now();
+    printf("%8s %10u %6d %10d %10.3f %12.3f %12s %12s %10llu\n", "fixed",
+           tree->count(), tree->depth(), tree->size(), ms(t1 - t0),
+           ms(t2 - t1), "-", "-", (unsigned long long)total);
+    expect(total == reference, "fixed hits");
+    expect(tree->check(), "fixed tree invariants");
+    delete tree;
+  }
+
+  {
+    // A cluster far below a root grown to take a distant point sits deeper
+    // than one fixed-point quantisation reaches.
+    FixedQuadTree* tree = new FixedQuadTree{};
+    vector<TreeNode> out;
+    uniform_real_distribution<f32> jitter(-1e-3f, 1e-3f);
+    for (int i = 0; i < 64; i++)
+      tree->insert({vec2{1, 1} + vec2{jitter(rng), jitter(rng)}}, out);
+    tree->insert({{3e6f, 3e6f}}, out);
+    for (int i = 0; i < 64; i++)
+      tree->insert({vec2{1, 1} + vec2{jitter(rng), jitter(rng)}}, out);
+    printf("deep fixed: %u entities, depth %d, root %g wide\n",
+           tree->count(), tree->depth(), tree->rect.s.x);
+    expect(tree->count() == 129 && tree->check(), "fixed insert past 32 bits");
+
+    // Erasing everything again must bring the root back.
+    tree->erase(Rect{{0, 0}, {1e8f, 1e8f}});
+    tree->erase_down();
+    expect(tree->is_none() && tree->rect.s.x == TreePolicy::root().s.x,
+           "empty root shrinks");
+    tree->insert({{1e5f, 1e5f}}, out);
+    tree->erase_down();
+    const f32 grown = tree->rect.s.x;
+    tree->insert({{1e5f + 1, 1e5f}}, out);
+    tree->erase(Rect{{1e5f, 1e5f}, {0.5f, 0.5f}});
+    tree->erase_down();
+    expect(tree->rect.s.x < grown && tree->check(), "leaf root shrinks");
+    delete tree;
+  }
+
+  {
+    // A root grown for one distant point must split the cells under the old
+    // root as deep as it would without the point.
+    QuadTree* near = new QuadTree{};
+    QuadTree* tree = new QuadTree{};
+    vector<TreeNode> out;
+    tree->insert({{1e9f, 1e9f}}, out);
+    uniform_real_distribution<f32> jitter(-1e-2f, 1e-2f);
+    for (int i = 0; i < 20000; i++) {
+      const TreeNode e = {vec2{1, 1} + vec2{jitter(rng), jitter(rng)}};
+      near->insert(e, out);
+      tree->insert(e, out);
+    }
+    const u32 before = max_leaf(*near), after = max_leaf(*tree);
+    printf("outlier: largest leaf %u, %u under a root %g wide\n", before, after,
+           tree->rect.s.x);
+    expect(after <= before && tree->check(), "leaves under a grown root");
+    delete near;
+    delete tree;
+  }
+
+  QuadTree* tree = new QuadTree{};
+  {
+    vector<TreeNode> out;
+    for (auto& p : pts)
+      tree->insert(p, out);
+  }
+
+  auto dist2 = [](vec2 p, TreeNode* e) {
+    const vec2 v = e->pos - p;
+    return dot(v, v);
+  };
+
+  {
+    vector<vector<TreeNode*>> batch;
+    vector<TreeNode*> hits;
+
+    auto t0 = Clock::now();
+    tree->find_batch(rects, batch);
+
+    auto t1 = Clock::now();
+    u64 single = 0, batched = 0;
+    int counter = 0;
+    for (auto& r : rects) {
+      hits.clear();
+      tree->find(r, hits, counter);
+      single += hits.size();
+    }
+
+    auto t2 = Clock::now();
+    for (auto& b : batch)
+      batched += b.size();
+    printf("find_batch: %.3f ms, find: %.3f ms (%llu vs %llu hits)\n",
+           ms(t1 - t0), ms(t2 - t1), (unsigned long long)batched,
+           (unsigned long long)single);
+    expect(batched == single, "find_batch hits");
+  }
+
+  {
+    constexpr u32 k = 8;
+    vector<TreeNode*> hits;
+    vector<f32> kth(queries);
+
+    auto t0 = Clock::now();
+    for (int i = 0; i < queries; i++) {
+      hits.clear();
+      tree->nearest(rects[i].p, k, hits);
+      kth[i] = hits.empty() ? 0 : dist2(rects[i].p, hits.back());
+    }
+
+    // Over-query a square around the point, then sort by distance.
+    auto t1 = Clock::now();
+    int worse = 0;
+    for (int i = 0; i < queries; i++) {
+      const vec2 p = rects[i].p;
+      hits.clear();
+      int counter = 0;
+      tree->find(rects[i], hits, counter);
+      auto mid = hits.begin() + min<size_t>(k, hits.size());
+      partial_sort(hits.begin(), mid, hits.end(), [&](auto l, auto r) {
+        return dist2(p, l) < dist2(p, r);
+      });
+      if (hits.size() >= k && dist2(p, hits[k - 1]) < kth[i])
+        worse++;
+    }
+
+    auto t2 = Clock::now();
+    printf("nearest k=%u: %.3f ms, find + sort: %.3f ms (%d misses)\n", k,
+           ms(t1 - t0), ms(t2 - t1), worse);
+    expect(!worse, "nearest misses");
+  }
+
+  {
+    vector<TreeNode*> hits;
+    u64 found = 0;
+
+    auto t0 = Clock::now();
+    for (auto& r : rects) {
+      hits.clear();
+      tree->find_radius(r.p, r.s.x * 0.5f, hits);
+      found += hits.size();
+    }
+
+    // The bounding square of the circle, filtered by distance afterwards.
+    // find's square is half-open and its edges are rounded, so it is widened
+    // by a few ulps of the centre to keep points on the circle.
+    auto t1 = Clock::now();
+    u64 copied = 0, kept = 0;
+    for (auto& r : rects) {
+      hits.clear();
+      int counter = 0;
+      const f32 ulps = fmaxf(fabsf(r.p.x), fabsf(r.p.y)) * 0x1p-20f;
+      tree->find(Rect{r.p, r.s + vec2{ulps, ulps}}, hits, counter);
+      copied += hits.size();
+      const f32 rr = r.s.x * r.s.x * 0.25f;
+      for (auto e : hits)
+        kept += dist2(r.p, e) <= rr;
+    }
+
+    auto t2 = Clock::now();
+    printf("find_radius: %.3f ms, find + filter: %.3f ms (%llu vs %llu hits, "
+           "%llu copied)\n",
+           ms(t1 - t0), ms(t2 - t1), (unsigned long long)found,
+           (unsigned long long)kept, (unsigned long long)copied);
+    expect(found == kept, "find_radius hits");
+  }
+
+  {
+    constexpr f32 radius = 1.f / 16.f;
+    const int n = queries / 10;
+    // Lines of sight from anywhere on the map to an entity's position.
+    uniform_real_distribution<f32> unit(-1.f, 1.f);
+    vector<pair<vec2, vec2>> segs;
+    for (int i = 0; i < n; i++)
+      segs.push_back({vec2{unit(rng), unit(rng)} * 512.f, rects[i].p});
+
+    vector<TreeNode*> hits;
+    u64 found = 0;
+    int rays = 0;
+
+    auto t0 = Clock::now();
+    for (auto& [a, b] : segs)
+      rays += tree->raycast(a, b - a, 1.f, radius).node != 0;
+
+    auto t1 = Clock::now();
+    for (auto& [a, b] : segs) {
+      hits.clear();
+      tree->segment_query(a, b, radius, hits);
+      found += hits.size();
+    }
+
+    // The segment's bounding box, filtered by distance afterwards.
+    auto t2 = Clock::now();
+    u64 copied = 0, kept = 0;
+    for (auto& [a, b] : segs) {
+      hits.clear();
+      int counter = 0;
+      const vec2 lo = {fminf(a.x, b.x), fminf(a.y, b.y)};
+      const vec2 hi = {fmaxf(a.x, b.x), fmaxf(a.y, b.y)};
+      const f32 ulps = fmaxf(fmaxf(fabsf(lo.x), fabsf(lo.y)),
+                             fmaxf(fabsf(hi.x), fabsf(hi.y))) *
+                       0x1p-20f;
+      const vec2 pad = vec2{radius, radius} + vec2{ulps, ulps};
+      tree->find(Rect{(lo + hi) * 0.5f, hi - lo + pad * 2.f}, hits, counter);
+      copied += hits.size();
+      const vec2 d = b - a;
+      for (auto e : hits) {
+        const vec2 m = e->pos - a;
+        const f32 s = fminf(fmaxf(dot(m, d) / dot(d, d), 0.f), 1.f);
+        const vec2 v = m - d * s;
+        kept += dot(v, v) <= radius * radius;
+      }
+    }
+
+    auto t3 = Clock::now();
+    // The first hit of every tenth ray against all entities, in double.
+    // Another entity counts as the first hit too if it is entered within
+    // tol of it.
+    vector<TreeNode*> all;
+    tree->collect(all);
+    auto enter = [&](vec2 a, vec2 d, const TreeNode* e) {
+      const f64 mx = f64(a.x) - e->pos.x, my = f64(a.y) - e->pos.y;
+      const f64 dd = f64(d.x) * d.x + f64(d.y) * d.y;
+      const f64 c = mx * mx + my * my - f64(radius) * radius;
+      const f64 h = mx * d.x + my * d.y;
+      const f64 disc = h * h - dd * c;
+      if (c <= 0)
+        return 0.0;
+      return h >= 0 || disc < 0 ? INFINITY : (-h - sqrt(disc)) / dd;
+    };
+    constexpr f64 tol = 1e-6;
+    int checked = 0, wrong = 0;
+    f64 worst = 0;
+    for (int i = 0; i < n; i += 10, checked++) {
+      const vec2 a = segs[i].first, d = segs[i].second - a;
+      const TreeNode* first = 0;
+      f64 t = 1;
+      for (auto e : all) {
+        const f64 te = enter(a, d, e);
+        if (te < t || (!first && te <= t)) {
+          first = e;
+          t = te;
+        }
+      }
+      const RayHit<TreeNode> hit = tree->raycast(a, d, 1.f, radius);
+      worst = std::max(worst, fabs(hit.t - t));
+      wrong += !hit.node != !first || fabs(hit.t - t) > tol ||
+               (hit.node && fabs(enter(a, d, hit.node) - t) > tol);
+    }
+    printf("raycast: %.3f ms (%d/%d hit, %d/%d first hits wrong, t off by "
+           "%.2g)\n",
+           ms(t1 - t0), rays, n, wrong, checked, worst);
+    expect(!wrong, "raycast first hits");
+    printf("segment_query: %.3f ms, find + filter: %.3f ms (%llu vs %llu "
+           "hits, %llu copied)\n",
+           ms(t2 - t1), ms(t3 - t2), (unsigned long long)found,
+           (unsigned long long)kept, (unsigned long long)copied);
+    expect(found == kept, "segment_query hits");
+  }
+
+  {
+    constexpr f32 radius = 1.f / 256.f;
+    u64 pairs = 0;
+
+    auto t0 = Clock::now();
+    tree->for_each_pair(radius, [&](TreeNode&, TreeNode&) { pairs++; });
+
+    // One radius query per entity sees every pair twice, plus itself.
+    auto t1 = Clock::now();
+    vector<TreeNode*> all, hits;
+    tree->collect(all);
+    u64 seen = 0;
+    for (auto e : all) {
+      hits.clear();
+      tree->find_radius(e->pos, radius, hits);
+      seen += hits.size();
+    }
+
+    auto t2 = Clock::now();
+    printf("for_each_pair: %.3f ms, find_radius per entity: %.3f ms (%llu "
+           "pairs, %llu expected)\n",
+           ms(t1 - t0), ms(t2 - t1), (unsigned long long)pairs,
+           (unsigned long long)(seen - all.size()) / 2);
+    expect(pairs == (seen - all.size()) / 2, "for_each_pair pairs");
+  }
+
+  {
+    const int n = min(points, 20000);
+    QuadTree* sky = new QuadTree{};
+    vector<TreeNode> out;
+    for (int i = 0; i < n; i++)
+      sky->insert(pts[i], out);
+
+    auto t0 = Clock::now();
+    sky->gravity(1.f);
+
+    // Direct O(n^2) sum with the same softening for reference.
+    auto t1 = Clock::now();
+    vector<TreeNode*> all;
+    sky->collect(all);
+    f64 err = 0;
+    for (auto e : all) {
+      vec2 a = {0, 0};
+      for (auto o : all) {
+        const vec2 d = o->pos - e->pos;
+        const f32 r2 = dot(d, d) + 1e-6f;
+        a += d * (1.f / (r2 * sqrtf(r2)));
+      }
+      err += len(e->vel - a) / fmaxf(len(a), 1e-20f);
+    }
+
+    auto t2 = Clock::now();
+    printf("gravity %d bodies: %.3f ms, direct: %.3f ms (mean rel. error "
+           "%.5f)\n",
+           n, ms(t1 - t0), ms(t2 - t1), err / all.size());
+    expect(err / all.size() < 0.02, "gravity error");
+    delete sky;
+
+    // Without softening every body still gets a finite pull from the others.
+    QuadTree* three = new QuadTree{};
+    for (vec2 p : {vec2{1, 1}, vec2{2, 1}, vec2{1, 3}})
+      three->insert({p, {}}, out);
+    three->gravity(1.f, 0.5f, 1.f, 0.f);
+    vector<TreeNode*> bodies;
+    three->collect(bodies);
+    bool finite = bodies.size() == 3;
+    for (auto e : bodies)
+      finite &= isfinite(e->vel.x) && isfinite(e->vel.y);
+    expect(finite, "gravity without softening");
+    delete three;
+  }
+
+  {
+    Snapshot snap;
+
+    auto t0 = Clock::now();
+    snap.build(*tree);
+
+    auto t1 = Clock::now();
+    vector<const TreeNode*> hits;
+    u64 total = 0;
+    for (auto& r : rects) {
+      hits.clear();
+      snap.find(r, hits);
+      total += hits.size();
+    }
+
+    auto t2 = Clock::now();
+    printf("snapshot: build %.3f ms, find %.3f ms (%llu hits)\n", ms(t1 - t0),
+           ms(t2 - t1), (unsigned long long)total);
+    expect(total == reference, "snapshot hits");
+  }
+
+  {
+    const u32 threads = std::max(thread::hardware_concurrency(), 2u);
+    Jobs jobs(threads);
+
+    auto t0 = Clock::now();
+    QuadTree* bulk = new QuadTree{};
+    bulk->build(pts);
+
+    auto t1 = Clock::now();
+    QuadTree* par = new QuadTree{};
+    par->build(pts, &jobs);
+
+    auto t2 = Clock::now();
+    printf("build: %.3f ms, on %u threads: %.3f ms (%d and %d nodes, %d by "
+           "insert)\n",
+           ms(t1 - t0), threads, ms(t2 - t1), bulk->size(), par->size(),
+           tree->size());
+    expect(bulk->check() && par->check(), "built tree invariants");
+    expect(same(*bulk, *tree) && same(*par, *tree), "build matches insert");
+    delete bulk;
+    delete par;
+  }
+
+  {
+    // A cluster under a root grown to take a distant point is built more
+    // than 32 levels down, past the bits of the keys it started with.
+    const u32 threads = std::max(thread::hardware_concurrency(), 2u);
+    Jobs jobs(threads);
+    vector<TreeNode> far, out;
+    uniform_real_distribution<f32> jitter(-1e-3f, 1e-3f);
+    for (int i = 0; i < 4096; i++)
+      far.push_back({vec2{1, 1} + vec2{jitter(rng), jitter(rng)}});
+    far.push_back({{1e9f, 1e9f}});
+
+    QuadTree* one = new QuadTree{};
+    for (auto& e : far)
+      one->insert(e, out);
+    QuadTree* bulk = new QuadTree{};
+    bulk->build(far);
+    QuadTree* par = new QuadTree{};
+    par->build(far, &jobs, 64);
+    printf("deep build: depth %d, %d nodes, %d by insert\n", bulk->depth(),
+           bulk->size(), one->size());
+    expect(bulk->check() && par->check(), "deep built tree invariants");
+    expect(same(*bulk, *one) && same(*par, *one), "deep build matches insert");
+    delete one;
+    delete bulk;
+    delete par;
+  }
+
+  {
+    // The same frames updated on one thread and on the pool, which must give
+    // the same tree.
+    const u32 threads = std::max(thread::hardware_concurrency(), 2u);
+    Jobs jobs(threads);
+    constexpr int FRAMES = 4;
+    uniform_real_distribution<f32> unit(-1.f, 1.f);
+    vector<TreeNode> moving = pts;
+    for (auto& e : moving)
+      e.vel = vec2{unit(rng), unit(rng)} * 1.f;
+
+    QuadTree* serial = new QuadTree{};
+    QuadTree* par = new QuadTree{};
+    serial->build(moving);
+    par->build(moving);
+    vector<TreeNode> v, w, out;
+    Clock::duration ts = {}, tp = {};
+    for (int f = 0; f < FRAMES; f++) {
+      auto t0 = Clock::now();
+      serial->update(1.f / 60.f, v);
+      auto t1 = Clock::now();
+      par->update(1.f / 60.f, w, jobs);
+      auto t2 = Clock::now();
+      ts += t1 - t0;
+      tp += t2 - t1;
+      expect(v.size() == w.size(), "parallel update escapers");
+      for (auto& e : v)
+        serial->insert(e, out);
+      for (auto& e : w)
+        par->insert(e, out);
+      v.clear();
+      w.clear();
+      serial->erase_down();
+      par->erase_down();
+    }
+    printf("update: %.3f ms, on %u threads: %.3f ms per frame\n",
+           ms(ts) / FRAMES, threads, ms(tp) / FRAMES);
+    expect(serial->check() && par->check(), "updated tree invariants");
+    expect(same(*serial, *par), "parallel update matches serial");
+    delete serial;
+    delete par;
+  }
+
+  {
+    // Frames of step with random velocities of growing speed, once always
+    // repairing and once always rebuilding, to show where the two cross.
+    const u32 threads = std::max(thread::hardware_concurrency(), 2u);
+    Jobs jobs(threads);
+    constexpr int FRAMES = 4;
+    uniform_real_distribution<f32> unit(-1.f, 1.f);
+    printf("step: %d frames on %u threads, ms/frame\n", FRAMES, threads);
+    printf("%10s %8s %10s %10s\n", "speed", "movers", "repair", "rebuild");
+    for (f32 speed : {0.001f, 0.01f, 0.1f, 1.f, 10.f, 100.f}) {
+      vector<TreeNode> moving = pts;
+      for (auto& e : moving)
+        e.vel = vec2{unit(rng), unit(rng)} * speed;
+
+      f64 t[2];
+      f32 share = 0;
+      for (int rebuild = 0; rebuild < 2; rebuild++) {
+        QuadTree* q = new QuadTree{};
+        q->build(moving, &jobs);
+        FrameStats stats;
+        stats.threshold = rebuild ? -1.f : 2.f;
+        vector<TreeNode> out;
+        auto t0 = Clock::now();
+        for (int f = 0; f < FRAMES; f++)
+          q->step(1.f / 60.f, out, stats, &jobs);
+        t[rebuild] = ms(Clock::now() - t0) / FRAMES;
+        share = stats.ratio();
+        expect(q->check(), "stepped tree invariants");
+        expect(q->count() + out.size() == moving.size(), "step keeps entities");
+        delete q;
+      }
+      printf("%10g %7.1f%% %10.3f %10.3f\n", speed, share * 100.f, t[0],
+             t[1]);
+    }
+  }
+
+  {
+    // The repair path of step against the same motion kept in an
+    // EntityStore, which integrates over flat arrays and relocates movers
+    // through their leaf pointers.
+    constexpr int FRAMES = 8;
+    uniform_real_distribution<f32> unit(-1.f, 1.f);
+    printf("entities: %d frames, ms/frame\n", FRAMES);
+    printf("%10s %8s %10s %10s\n", "speed", "movers", "tree", "store");
+    for (f32 speed : {0.01f, 1.f, 100.f}) {
+      vector<TreeNode> moving = pts;
+      for (auto& e : moving)
+        e.vel = vec2{unit(rng), unit(rng)} * speed;
+
+      QuadTree* q = new QuadTree{};
+      q->build(moving);
+      FrameStats stats;
+      stats.threshold = 2.f;
+      vector<TreeNode> out;
+      auto t0 = Clock::now();
+      for (int f = 0; f < FRAMES; f++)
+        q->step(1.f / 60.f, out, stats);
+      auto t1 = Clock::now();
+      delete q;
+
+      EntityStore* store = new EntityStore{};
+      for (auto& e : moving)
+        store->add(e.pos, e.vel);
+      u32 movers = 0;
+      auto t2 = Clock::now();
+      for (int f = 0; f < FRAMES; f++)
+        movers = store->step(1.f / 60.f);
+      auto t3 = Clock::now();
+      if (store->tree.count() != stats.entities)
+        printf("entities: %u in the store, %u in the tree\n",
+               store->tree.count(), stats.entities);
+      expect(store->tree.count() == stats.entities, "store entity count");
+      expect(store->tree.check(), "store tree invariants");
+      delete store;
+
+      printf("%10g %7.1f%% %10.3f %10.3f\n", speed,
+             100.f * movers / moving.size(), ms(t1 - t0) / FRAMES,
+             ms(t3 - t2) / FRAMES);
+    }
+
+    // An entity the tree dropped must come back once it is in range, even
+    // inside the cell it was dropped from.
+    EntityStore* store = new EntityStore{};
+    const Entity a = store->add({1, 1}, {1e31f, 0});
+    store->add({2, 2}, {});
+    store->step(1.f);
+    const u32 dropped = store->tree.count();
+    store->vx[a.index] = -1e31f;
+    store->step(1.f);
+    expect(dropped == 1 && store->tree.count() == 2 && store->tree.check(),
+           "dropped entity comes back");
+    delete store;
+  }
+
+  {
+    // Nudging known entities: through handles, and on a QuadTree by erasing
+    // a small rect around the old position and inserting at the new one.
+    // In the denser clusters that rect also takes neighbours, which the
+    // erased count shows.
+    const int moves = queries;
+    normal_distribution<f32> nudge(0.f, 0.01f);
+    vector<int> which(moves);
+    vector<vec2> to(moves);
+    for (int i = 0; i < moves; i++) {
+      which[i] = pick(rng);
+      to[i] = vec2{nudge(rng), nudge(rng)};
+    }
+
+    EntityStore* store = new EntityStore{};
+    vector<Entity> handles;
+    for (auto& e : pts)
+      handles.push_back(store->add(e.pos, {}));
+    QuadTree* q = new QuadTree{};
+    q->build(pts);
+    vector<vec2> at(pts.size());
+    for (size_t i = 0; i < pts.size(); i++)
+      at[i] = pts[i].pos;
+    vector<TreeNode> buf;
+
+    auto t0 = Clock::now();
+    for (int i = 0; i < moves; i++) {
+      const Entity h = handles[which[i]];
+      store->move(h, store->pos(h.index) + to[i]);
+    }
+
+    auto t1 = Clock::now();
+    u32 erased = 0;
+    for (int i = 0; i < moves; i++) {
+      vec2& p = at[which[i]];
+      // A few float steps wide around p.
+      const f32 s = fmaxf(fabsf(p.x), fabsf(p.y)) * 0x1p-20f + LO;
+      erased += q->erase(Rect{p, vec2{s, s}});
+      p += to[i];
+      q->insert({p, {}}, buf);
+    }
+    q->erase_down();
+
+    auto t2 = Clock::now();
+    printf("handles: %d moves %.3f ms, by erase and insert %.3f ms (%u "
+           "erased)\n",
+           moves, ms(t1 - t0), ms(t2 - t1), erased);
+    expect(store->tree.check() && store->tree.count() == pts.size(),
+           "store tree after moves");
+    expect(q->check(), "tree invariants after erase");
+
+    // A removed slot's fresh handle must not resolve, or remove would free
+    // the slot twice and two adds would share it.
+    const Entity gone = handles[0];
+    store->remove(gone);
+    const Entity ghost = store->handle(gone.index);
+    expect(!store->alive(gone) && !store->alive(ghost) &&
+               !store->move(ghost, {0, 0}) && !store->remove(ghost) &&
+               store->free.size() == 1,
+           "free slot handles");
+    const Entity a = store->add(pts[0].pos, {});
+    const Entity b = store->add(pts[0].pos, {});
+    expect(a.index == gone.index && b.index != a.index && store->alive(a) &&
+               !store->alive(gone),
+           "slot reuse");
+    store->remove(b);
+
+    // Moving a dropped entity back to where it was must put it back in the
+    // tree.
+    EntityStore* two = new EntityStore{};
+    const Entity c = two->add({1, 1}, {});
+    two->add({2, 2}, {});
+    two->move(c, {NAN, NAN});
+    two->move(c, {1, 1});
+    expect(two->tree.count() == two->count() && two->tree.check(),
+           "move back after a drop");
+    delete two;
+
+    // A second store must leave the first one's tree alone.
+    EntityStore* other = new EntityStore{};
+    for (int i = 0; i < 1000; i++)
+      other->add(vec2{f32(i % 40), f32(i / 40)} * 16.f, {1, 1});
+    other->step(1.f);
+    store->step(1.f / 60.f);
+    expect(store->tree.check() && other->tree.check() &&
+               store->tree.count() == pts.size() && other->count() == 1000,
+           "two stores");
+    delete other;
+    delete store;
+    delete q;
+  }
+
+  {
+    const u32 threads = std::max(thread::hardware_concurrency(), 2u);
+    Jobs jobs(threads);
+    QuadTree* shared = new QuadTree{};
+
+    auto t0 = Clock::now();
+    atomic<int> pending = 0;
+    const size_t slice = (pts.size() + threads - 1) / threads;
+    for (size_t lo = 0; lo < pts.size(); lo += slice) {
+      const size_t hi = std::min(pts.size(), lo + slice);
+      jobs.spawn(pending, [&, lo, hi] {
+        for (size_t i = lo; i < hi; i++)
+          shared->insert_concurrent(pts[i]);
+      });
+    }
+    jobs.wait(pending);
+
+    auto t1 = Clock::now();
+    printf("insert_concurrent on %u threads: %.3f ms (%u entities, %u in "
+           "the serial tree)\n",
+           threads, ms(t1 - t0), shared->count(), tree->count());
+    expect(shared->check(), "concurrent tree invariants");
+    expect(same(*shared, *tree), "insert_concurrent matches insert");
+    delete shared;
+  }
+
+  {
+    // The same clusters lifted into 3D, queried with cubes around points.
+    normal_distribution<f32> spread(0.f, 1.f);
+    vector<Body<f32, 3>> bodies;
+    for (auto& p : pts) {
+      const f32 z = p.pos.x * 0.5f + spread(rng) * 4.f;
+      bodies.push_back({{p.pos.x, p.pos.y, z}, {}});
+    }
+
+    auto t0 = Clock::now();
+    Octree* oct = new Octree{};
+    vector<Body<f32, 3>> out;
+    for (auto& b : bodies)
+      oct->insert(b, out);
+
+    auto t1 = Clock::now();
+    vector<Body<f32, 3>*> hits;
+    u64 total = 0;
+    const int n = queries / 10;
+    int counter = 0;
+    for (int i = 0; i < n; i++) {
+      const f32 s = rects[i].s.x * 8.f;
+      hits.clear();
+      oct->find({bodies[i].pos, {s, s, s}}, hits, counter);
+      total += hits.size();
+    }
+
+    auto t2 = Clock::now();
+    u64 brute = 0;
+    for (int i = 0; i < n; i++) {
+      const f32 s = rects[i].s.x * 8.f;
+      const Box<f32, 3> b = {bodies[i].pos, {s, s, s}};
+      for (auto& e : bodies)
+        brute += b.contains(e.pos);
+    }
+
+    auto t3 = Clock::now();
+    printf("octree: %u bodies, depth %d, nodes %d, build %.3f ms, find %.3f "
+           "ms, scan %.3f ms (%llu vs %llu hits)\n",
+           oct->count(), oct->depth(), oct->size(), ms(t1 - t0), ms(t2 - t1),
+           ms(t3 - t2), (unsigned long long)total, (unsigned long long)brute);
+    expect(total == brute, "octree hits");
+    expect(oct->check(), "octree invariants");
+    delete oct;
+  }
+
+  delete tree;
+  if (failed)
+    printf("some checks FAILED\n");
+  return failed;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <new>
+#include <utility>
+
+#include "vec.h"
+
+// Entities held by a leaf. Up to N of them live inside the node; past that
+// the bucket moves to the heap and keeps doubling. Entities are moved with
+// memcpy and never destroyed, so T must be plain data.
+template <class T, u32 N>
+struct Bucket {
+  static constexpr u32 INLINE = N;
+
+  u32 n = 0;
+  u32 cap = INLINE;
+  union {
+    T inl[INLINE];
+    T* heap;
+  };
+
+  Bucket() {}
+
+  Bucket(Bucket&& b) : n(b.n), cap(b.cap) {
+    if (cap > INLINE)
+      heap = b.heap;
+    else
+      memcpy((void*)inl, (void*)b.inl, n * sizeof(T));
+    b.n = 0;
+    b.cap = INLINE;
+  }
+
+  Bucket& operator=(Bucket&& b) {
+    if (this != &b) {
+      this->~Bucket();
+      new (this) Bucket(std::move(b));
+    }
+    return *this;
+  }
+
+  ~Bucket() {
+    if (cap > INLINE)
+      delete[] heap;
+  }
+
+  Bucket(const Bucket&) = delete;
+  Bucket& operator=(const Bucket&) = delete;
+
+  T* begin() { return cap > INLINE ? heap : inl; }
+  T* end() { return begin() + n; }
+  T& operator[](u32 i) { return begin()[i]; }
+  u32 size() const { return n; }
+
+  void push(T v) {
+    if (n == cap) {
+      T* tmp = new T[cap * 2];
+      memcpy((void*)tmp, (void*)begin(), n * sizeof(T));
+      if (cap > INLINE)
+        delete[] heap;
+      heap = tmp;
+      cap *= 2;
+    }
+    begin()[n++] = v;
+  }
+
+  // Swaps the last entity into slot i.
+  void remove(u32 i) { begin()[i] = begin()[--n]; }
+
+  // Empties the bucket and gives back any heap storage.
+  void reset() {
+    if (cap > INLINE)
+      delete[] heap;
+    n = 0;
+    cap = INLINE;
+  }
+};
@@ -0,0 +1,141 @@
+#include "entities.h"
+
+// EntityTree is instantiated implicitly from here; other translation units
+// that query it include quadtree.inl as well.
+#include "quadtree.inl"
+
+#include <bit>
+
+using namespace std;
+
+EntityStore::EntityStore() {
+  tree.context = this;
+}
+
+EntityStore::~EntityStore() {
+  tree.clear();
+}
+
+Entity EntityStore::add(vec2 p, vec2 v) {
+  u32 e;
+  if (free.size()) {
+    e = free.back();
+    free.pop_back();
+  } else {
+    e = x.size();
+    for (auto a : {&x, &y, &vx, &vy, &x0, &y0, &x1, &y1})
+      a->push_back(0);
+    leaf.push_back(0);
+    gen.push_back(0);
+  }
+  gen[e]++;
+  x[e] = p.x;
+  y[e] = p.y;
+  vx[e] = v.x;
+  vy[e] = v.y;
+
+  // Left for placed to fill in, so if the tree drops the entity it shows
+  // as a mover with no leaf, like any other dropped one.
+  x0[e] = y0[e] = x1[e] = y1[e] = NAN;
+  leaf[e] = 0;
+
+  vector<u32> buf;
+  tree.insert(e, buf);
+  return {e, gen[e]};
+}
+
+bool EntityStore::move(Entity h, vec2 p) {
+  if (!alive(h))
+    return false;
+  const u32 e = h.index;
+  x[e] = p.x;
+  y[e] = p.y;
+  if (x0[e] <= p.x && y0[e] <= p.y && p.x < x1[e] && p.y < y1[e])
+    return true;
+
+  // As in step, so that a dropped entity cannot look placed.
+  x0[e] = y0[e] = x1[e] = y1[e] = NAN;
+  if (auto l = leaf[e]) {
+    leaf[e] = 0;
+    l->relocate(e);
+  } else {
+    vector<u32> buf;
+    tree.insert(e, buf);
+  }
+  return true;
+}
+
+bool EntityStore::remove(Entity h) {
+  if (!alive(h))
+    return false;
+  const u32 e = h.index;
+  if (auto l = leaf[e])
+    l->unlink(e);
+  leaf[e] = 0;
+  gen[e]++;
+  x[e] = y[e] = vx[e] = vy[e] = 0;
+  x0[e] = y0[e] = -INFINITY;
+  x1[e] = y1[e] = INFINITY;
+  free.push_back(e);
+  return true;
+}
+
+// A lane is inside when all four compares hold, so NaN positions count as
+// movers and are dropped by the reinsertion.
+void EntityStore::integrate(f32 dt, vector<u32>& out) {
+  const u32 n = size();
+  u32 i = 0;
+#ifdef QUAD_SSE
+  const __m128 t = _mm_set1_ps(dt);
+  for (; i + 4 <= n; i += 4) {
+    const __m128 px =
+        _mm_add_ps(_mm_loadu_ps(&x[i]), _mm_mul_ps(_mm_loadu_ps(&vx[i]), t));
+    const __m128 py =
+        _mm_add_ps(_mm_loadu_ps(&y[i]), _mm_mul_ps(_mm_loadu_ps(&vy[i]), t));
+    _mm_storeu_ps(&x[i], px);
+    _mm_storeu_ps(&y[i], py);
+
+    const __m128 in = _mm_and_ps(
+        _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(&x0[i]), px),
+                   _mm_cmple_ps(_mm_loadu_ps(&y0[i]), py)),
+        _mm_and_ps(_mm_cmplt_ps(px, _mm_loadu_ps(&x1[i])),
+                   _mm_cmplt_ps(py, _mm_loadu_ps(&y1[i]))));
+    for (u32 m = ~_mm_movemask_ps(in) & 15; m; m &= m - 1)
+      out.push_back(i + std::countr_zero(m));
+  }
+#endif
+  for (; i < n; i++) {
+    x[i] += vx[i] * dt;
+    y[i] += vy[i] * dt;
+    if (!(x0[i] <= x[i] && y0[i] <= y[i] && x[i] < x1[i] && y[i] < y1[i]))
+      out.push_back(i);
+  }
+}
+
+u32 EntityStore::step(f32 dt) {
+  movers.clear();
+  integrate(dt, movers);
+  // Clearing the leaf and bounds first leaves both unset for entities the
+  // tree drops, so they stay movers and are put back once in range.
+  vector<u32> buf;
+  for (u32 e : movers) {
+    x0[e] = y0[e] = x1[e] = y1[e] = NAN;
+    if (auto l = leaf[e]) {
+      leaf[e] = 0;
+      l->relocate(e);
+    } else {
+      tree.insert(e, buf);
+    }
+  }
+  tree.erase_down();
+  return movers.size();
+}
+
+void EntityStore::placed(u32 e, EntityTree& node) {
+  const Range r = node.rect.range();
+  x0[e] = r.lo.x;
+  y0[e] = r.lo.y;
+  x1[e] = r.hi.x;
+  y1[e] = r.hi.y;
+  leaf[e] = &node;
+}
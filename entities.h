@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vector>
+
+#include "quadtree.h"
+
+struct EntityStore;
+struct EntityPolicy;
+
+// A tree whose leaves hold indices into an EntityStore.
+using EntityTree = BasicQuadTree<u32, EntityPolicy>;
+
+// Names one entity of a store for as long as it lives. Adding an entity and
+// removing it both bump its slot's generation, so live slots have odd
+// generations and free ones even. Old handles stop resolving instead of
+// naming whatever reuses the slot, and a handle made for a free slot never
+// resolves at all.
+struct Entity {
+  u32 index = 0;
+  u32 gen = 0;
+};
+
+// Positions come from the store the indices refer to, and the tree tells the
+// store which leaf every entity ends up in. The store is the tree's context,
+// so each store's tree reads its own arrays.
+struct EntityPolicy : TreePolicy {
+  using Context = EntityStore*;
+
+  static vec2 pos(EntityStore* store, u32 e);
+
+  template <class Node>
+  static void placed(EntityStore* store, u32 e, Node& leaf);
+};
+
+// Entities kept as one array per component instead of a TreeNode each, so
+// integration streams through memory in index order whatever the tree looks
+// like. Next to them the store keeps the bounds of each entity's cell and a
+// pointer to its leaf, both maintained by the tree through
+// EntityPolicy::placed. Finding the entities that left their cell is then a
+// compare against arrays too, and moving one touches only its own leaf and
+// the path up to the first ancestor still containing it.
+//
+// The constructor makes the store its tree's context, which is why stores
+// cannot be copied or moved. Entities dropped by the tree keep their index
+// with a null leaf and NaN bounds. integrate still moves them and reports
+// them as movers every step, and step or move puts them back in the tree
+// once they are in range again. Remove entities through the store: erasing
+// from the tree directly would leave leaf pointing at freed nodes.
+//
+// leaf doubles as the handle table. Since every entity knows its leaf, move
+// and remove go straight to it without searching the tree.
+struct EntityStore {
+  std::vector<f32> x, y, vx, vy;
+  // Cell bounds as Rect::range gives them: inside is x0 <= x < x1. Free
+  // slots get infinite bounds so integrate never reports them.
+  std::vector<f32> x0, y0, x1, y1;
+  std::vector<EntityTree*> leaf;
+  // Odd while the slot is live.
+  std::vector<u32> gen;
+  // Slots of removed entities, reused by add.
+  std::vector<u32> free;
+
+  EntityTree tree;
+  // Indices of the entities that left their cell in the last step.
+  std::vector<u32> movers;
+
+  EntityStore();
+  EntityStore(const EntityStore&) = delete;
+  EntityStore& operator=(const EntityStore&) = delete;
+  ~EntityStore();
+
+  // Slots, live or free. Query results and movers index these.
+  u32 size() const { return x.size(); }
+  u32 count() const { return x.size() - free.size(); }
+  vec2 pos(u32 e) const { return {x[e], y[e]}; }
+
+  // The handle of the entity at index e, as found by a tree query. For a
+  // free slot it is a handle alive rejects.
+  Entity handle(u32 e) const { return {e, gen[e]}; }
+  bool alive(Entity h) const {
+    return h.index < gen.size() && gen[h.index] == h.gen && (h.gen & 1);
+  }
+
+  // Inserts an entity into the tree, in a free slot if there is one.
+  Entity add(vec2 p, vec2 v);
+  // Both return false for stale handles. move puts the entity at p; only
+  // when that leaves its cell does the tree change. Cells emptied by
+  // remove are collapsed by the next step.
+  bool move(Entity h, vec2 p);
+  bool remove(Entity h);
+
+  // Advances every entity by dt and appends the ones now outside their cell
+  // to out. Four entities at a time with SSE.
+  void integrate(f32 dt, std::vector<u32>& out);
+  // integrate, then relocate every mover, retry the ones the tree dropped,
+  // and compact the tree. Returns the number of movers.
+  u32 step(f32 dt);
+
+  void placed(u32 e, EntityTree& node);
+};
+
+inline vec2 EntityPolicy::pos(EntityStore* store, u32 e) {
+  return store->pos(e);
+}
+
+template <class Node>
+inline void EntityPolicy::placed(EntityStore* store, u32 e, Node& leaf) {
+  store->placed(e, leaf);
+}
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "linear.h"
+#include "quadtree.h"
+#include "snapshot.h"
+
+using namespace std;
+
+// Runs the same per-frame loop as the viewer at a fixed timestep, with the
+// mouse replaced by a scripted cursor, so tree throughput can be measured on
+// machines that cannot open a window.
+//
+// usage: quad_headless [frames] [spawn per frame] [seed]
+//                      [tree|linear|adaptive] [threads] [readers]
+// adaptive runs the tree through QuadTree::step, which can rebuild instead of
+// repairing once enough entities move; QUAD_REBUILD sets the share of movers
+// that triggers it, and without it the tree is always repaired. With
+// threads > 0 the tree is updated on a work-stealing pool. With readers > 0
+// the tree publishes a snapshot after every frame and that many threads
+// query the latest one for as long as the simulation runs.
+// Set QUAD_HUGE_PAGES=1 to back the node pool with huge pages.
+//
+// The tree's invariants are checked after the last frame, and the run exits
+// with 1 when they do not hold. Configure with -DQUAD_SANITIZE=thread (or
+// address,undefined) to run the same frames under a sanitizer, e.g.
+// quad_headless 300 64 1 adaptive 4 2 for the pool and snapshot readers.
+
+using Clock = chrono::steady_clock;
+
+static f64 ms(Clock::duration d) {
+  return chrono::duration<f64, milli>(d).count();
+}
+
+static Jobs* jobs = 0;
+static SnapshotCell* snapshots = 0;
+static FrameStats* stats = 0;
+
+// step also reinserts and compacts, leaving the later phases nothing to do.
+static void update(QuadTree& tree, f32 dt, vector<TreeNode>& v) {
+  if (stats)
+    tree.step(dt, v, *stats, jobs);
+  else if (jobs)
+    tree.update(dt, v, *jobs);
+  else
+    tree.update(dt, v);
+}
+
+static void update(LinearQuadTree& tree, f32 dt, vector<TreeNode>& v) {
+  tree.update(dt, v);
+}
+
+static void publish(QuadTree& tree, u64 frame) {
+  if (snapshots)
+    snapshots->publish(tree, frame);
+}
+
+static void publish(LinearQuadTree&, u64) {}
+
+struct Reader {
+  thread t;
+  u64 queries = 0;
+  u64 hits = 0;
+  Clock::duration worst = {};
+};
+
+static void query_loop(Reader& r, const atomic<bool>& done, u32 seed) {
+  mt19937 rng(seed);
+  uniform_real_distribution<f32> unit(-1.f, 1.f);
+  vector<const TreeNode*> hits;
+  while (!done.load(memory_order_relaxed)) {
+    auto t0 = Clock::now();
+    auto snap = snapshots->get();
+    if (!snap)
+      continue;
+    hits.clear();
+    snap->find(Rect{vec2{unit(rng), unit(rng)}, {0.25f, 0.25f}}, hits);
+    r.worst = std::max(r.worst, Clock::now() - t0);
+    r.hits += hits.size();
+    r.queries++;
+  }
+}
+
+static void describe(QuadTree& tree) {
+  printf("nodes %d, depth %d, count %u, root %g wide\n", tree.size(),
+         tree.depth(), tree.count(), tree.rect.s.x);
+  printf("pool: %llu live blocks, %zu chunks\n",
+         (unsigned long long)QuadTree::pool.live, QuadTree::pool.chunks.size());
+}
+
+static void describe(LinearQuadTree& tree) {
+  printf("linear: %zu entries\n", tree.items.size());
+}
+
+static bool check(QuadTree& tree) {
+  return tree.check();
+}
+
+static bool check(LinearQuadTree&) {
+  return true;
+}
+
+template <class Tree>
+static bool run(Tree* tree, int frames, int spawn, u32 seed) {
+  constexpr f32 dt = 1.f / 60.f;
+  constexpr f32 brush = 1.f / 16.f;
+
+  mt19937 rng(seed);
+  uniform_real_distribution<f32> unit(-1.f, 1.f);
+
+  vector<TreeNode> front_buf;
+
+  Clock::duration t_insert = {}, t_erase = {}, t_update = {}, t_reinsert = {},
+                  t_compact = {};
+
+  for (int frame = 0; frame < frames; frame++) {
+    vector<TreeNode> back_buf = std::move(front_buf);
+
+    // The cursor sweeps a circle over the [-1, 1] view the viewer starts with.
+    const f32 a = frame * dt;
+    const vec2 cursor = vec2{cosf(a), sinf(a * 1.3f)} * 0.75f;
+
+    auto t0 = Clock::now();
+    for (int i = 0; i < spawn; i++) {
+      vec2 p = cursor + vec2{unit(rng), unit(rng)} * brush;
+      vec2 v = vec2{unit(rng), unit(rng)} * 0.05f;
+      tree->insert({p, v}, back_buf);
+    }
+
+    auto t1 = Clock::now();
+    if (frame % 30 == 29) {
+      tree->erase(Rect{-cursor, vec2{brush, brush} * 4.f});
+    }
+
+    auto t2 = Clock::now();
+    update(*tree, dt, back_buf);
+
+    auto t3 = Clock::now();
+    for (auto& c : back_buf)
+      tree->insert(c, front_buf);
+
+    auto t4 = Clock::now();
+    tree->erase_down();
+
+    publish(*tree, frame);
+
+    auto t5 = Clock::now();
+    t_insert += t1 - t0;
+    t_erase += t2 - t1;
+    t_update += t3 - t2;
+    t_reinsert += t4 - t3;
+    t_compact += t5 - t4;
+  }
+
+  vector<TreeNode*> all;
+  tree->collect(all);
+
+  const f64 total = ms(t_insert + t_erase + t_update + t_reinsert + t_compact);
+  printf("frames %d, entities %zu\n", frames, all.size());
+  describe(*tree);
+  printf("total %.3f ms, %.4f ms/frame\n", total, total / frames);
+  printf("  insert     %.3f ms\n", ms(t_insert));
+  printf("  erase      %.3f ms\n", ms(t_erase));
+  printf("  update     %.3f ms\n", ms(t_update));
+  printf("  reinsert   %.3f ms\n", ms(t_reinsert));
+  printf("  erase_down %.3f ms\n", ms(t_compact));
+  if (snapshots)
+    printf("  (erase_down includes publishing a snapshot)\n");
+  if (stats)
+    printf("step: %llu of %llu frames rebuilt, last frame %s with %.1f%% "
+           "movers\n",
+           (unsigned long long)stats->rebuilds,
+           (unsigned long long)stats->frames,
+           stats->rebuilt ? "rebuilt" : "repaired", stats->ratio() * 100.f);
+
+  if (!check(*tree)) {
+    printf("FAILED: tree invariants\n");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const int frames = argc > 1 ? atoi(argv[1]) : 300;
+  const int spawn = argc > 2 ? atoi(argv[2]) : 64;
+  const u32 seed = argc > 3 ? atoi(argv[3]) : 1;
+  const char* backend = argc > 4 ? argv[4] : "tree";
+  const int threads = argc > 5 ? atoi(argv[5]) : 0;
+  const int readers = argc > 6 ? atoi(argv[6]) : 0;
+
+  if (threads > 0)
+    jobs = new Jobs(threads);
+
+  QuadTree::pool.huge = getenv("QUAD_HUGE_PAGES") != 0;
+
+  bool ok;
+  if (!strcmp(backend, "linear")) {
+    LinearQuadTree* tree = new LinearQuadTree{};
+    ok = run(tree, frames, spawn, seed);
+    delete tree;
+  } else {
+    if (!strcmp(backend, "adaptive")) {
+      stats = new FrameStats{};
+      if (const char* r = getenv("QUAD_REBUILD"))
+        stats->threshold = atof(r);
+    }
+    QuadTree* tree = new QuadTree{};
+    atomic<bool> done = false;
+    vector<Reader> rs(readers);
+    if (readers > 0) {
+      snapshots = new SnapshotCell{};
+      snapshots->publish(*tree, 0);
+      for (int i = 0; i < readers; i++)
+        rs[i].t = thread(query_loop, ref(rs[i]), cref(done), seed + i + 1);
+    }
+
+    ok = run(tree, frames, spawn, seed);
+
+    done = true;
+    for (auto& r : rs) {
+      r.t.join();
+      printf("reader: %llu queries, %llu hits, worst %.3f ms\n",
+             (unsigned long long)r.queries, (unsigned long long)r.hits,
+             ms(r.worst));
+    }
+    delete snapshots;
+    delete stats;
+    delete tree;
+  }
+
+  delete jobs;
+  return !ok;
+}
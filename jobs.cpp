@@ -0,0 +1,85 @@
+#include "jobs.h"
+
+using namespace std;
+
+static thread_local u32 worker = 0;
+
+Jobs::Jobs(u32 n) {
+  if (!n)
+    n = std::max(thread::hardware_concurrency(), 1u);
+
+  for (u32 i = 0; i < n; i++)
+    queues.push_back(make_unique<Queue>());
+  for (u32 i = 1; i < n; i++)
+    threads.emplace_back([this, i] { work(i); });
+}
+
+Jobs::~Jobs() {
+  {
+    lock_guard<mutex> l(sleep_m);
+    quit = true;
+  }
+  sleep_cv.notify_all();
+  for (auto& t : threads)
+    t.join();
+}
+
+void Jobs::spawn(atomic<int>& pending, function<void()> fn) {
+  pending++;
+  {
+    auto& q = *queues[worker % queues.size()];
+    lock_guard<mutex> l(q.m);
+    q.q.push_back({std::move(fn), &pending});
+  }
+  queued++;
+  if (threads.empty())
+    return;
+  // Taking the lock orders this against a worker checking queued before it
+  // goes to sleep, so the notify cannot be lost.
+  { lock_guard<mutex> l(sleep_m); }
+  sleep_cv.notify_one();
+}
+
+bool Jobs::run_one(u32 self) {
+  Task t;
+  bool found = false;
+  for (u32 i = 0; i < queues.size() && !found; i++) {
+    auto& q = *queues[(self + i) % queues.size()];
+    lock_guard<mutex> l(q.m);
+    if (q.q.empty())
+      continue;
+    if (i == 0) {
+      t = std::move(q.q.back());
+      q.q.pop_back();
+    } else {
+      t = std::move(q.q.front());
+      q.q.pop_front();
+    }
+    found = true;
+  }
+
+  if (!found)
+    return false;
+
+  queued--;
+  t.fn();
+  t.pending->fetch_sub(1, memory_order_release);
+  return true;
+}
+
+void Jobs::wait(atomic<int>& pending) {
+  while (pending.load(memory_order_acquire) > 0)
+    if (!run_one(worker % queues.size()))
+      this_thread::yield();
+}
+
+void Jobs::work(u32 self) {
+  worker = self;
+  while (!quit) {
+    if (run_one(self))
+      continue;
+
+    unique_lock<mutex> l(sleep_m);
+    sleep_cv.wait(l, [this] { return quit || queued > 0; });
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "vec.h"
+
+// Fork-join thread pool with one deque per worker. A worker pushes and pops
+// its own tasks at the back and steals from the front of the others, so
+// forks stay on the thread that made them unless someone is idle. The thread
+// that constructs the pool is worker 0 and takes part while it waits.
+struct Jobs {
+  struct Task {
+    std::function<void()> fn;
+    std::atomic<int>* pending;
+  };
+
+  struct Queue {
+    std::mutex m;
+    std::deque<Task> q;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::atomic<bool> quit = false;
+  std::atomic<int> queued = 0;
+  std::mutex sleep_m;
+  std::condition_variable sleep_cv;
+
+  // 0 uses every hardware thread.
+  Jobs(u32 n = 0);
+  ~Jobs();
+
+  Jobs(const Jobs&) = delete;
+  Jobs& operator=(const Jobs&) = delete;
+
+  u32 size() const { return queues.size(); }
+
+  // Queues fn on the calling worker and counts it in pending.
+  void spawn(std::atomic<int>& pending, std::function<void()> fn);
+  // Runs queued tasks, stealing if needed, until pending drops to zero.
+  void wait(std::atomic<int>& pending);
+
+  bool run_one(u32 self);
+  void work(u32 self);
+};
@@ -0,0 +1,148 @@
+#include "linear.h"
+
+#include <algorithm>
+
+using namespace std;
+
+static bool by_key(const LinearQuadTree::Entry& l,
+                   const LinearQuadTree::Entry& r) {
+  return l.key < r.key;
+}
+
+// Quantised in double so that, for points inside the root, a key bit is set
+// exactly when the point is on the upper side of the matching split line.
+u64 LinearQuadTree::key(vec2 v) const {
+  const Range r = rect.range();
+  const f64 fx = (f64(v.x) - r.lo.x) * (4294967296.0 / rect.s.x);
+  const f64 fy = (f64(v.y) - r.lo.y) * (4294967296.0 / rect.s.y);
+  const u32 x = fx <= 0 ? 0 : fx >= 4294967295.0 ? 0xffffffff : u32(fx);
+  const u32 y = fy <= 0 ? 0 : fy >= 4294967295.0 ? 0xffffffff : u32(fy);
+  return morton(x, y);
+}
+
+void LinearQuadTree::insert(TreeNode v, vector<TreeNode>& buf) {
+  if (!rect.contains(v.pos)) {
+    return;
+  }
+
+  pending.push_back({key(v.pos), v});
+}
+
+void LinearQuadTree::flush() {
+  if (pending.empty())
+    return;
+
+  sort(pending.begin(), pending.end(), by_key);
+  const size_t mid = items.size();
+  items.insert(items.end(), pending.begin(), pending.end());
+  inplace_merge(items.begin(), items.begin() + mid, items.end(), by_key);
+  pending.clear();
+}
+
+void LinearQuadTree::erase(Rect r) {
+  flush();
+  items.erase(remove_if(items.begin(), items.end(),
+                        [&](const Entry& e) { return r.contains(e.node.pos); }),
+              items.end());
+}
+
+// There are no empty cells to collapse; just merge staged inserts.
+void LinearQuadTree::erase_down() {
+  flush();
+}
+
+// Entities whose new key is out of order with their neighbours are pulled out
+// and merged back, so the cost is linear plus a sort of the movers only.
+void LinearQuadTree::update(f32 dt, vector<TreeNode>& v) {
+  flush();
+
+  size_t w = 0;
+  for (auto& e : items) {
+    e.node.update(dt);
+    if (!rect.contains(e.node.pos)) {
+      v.push_back(e.node);
+      continue;
+    }
+    e.key = key(e.node.pos);
+    items[w++] = e;
+  }
+  items.resize(w);
+
+  // Checking the successor as well keeps one entity that jumped forward
+  // from pushing everything behind it out of place.
+  const size_t n = items.size();
+  u64 last = 0;
+  w = 0;
+  for (size_t i = 0; i < n; i++) {
+    const Entry e = items[i];
+    if (e.key < last || (i + 1 < n && e.key > items[i + 1].key)) {
+      pending.push_back(e);
+    } else {
+      last = e.key;
+      items[w++] = e;
+    }
+  }
+  items.resize(w);
+  flush();
+}
+
+void LinearQuadTree::collect(vector<TreeNode*>& collection) {
+  flush();
+  for (auto& e : items)
+    collection.push_back(&e.node);
+}
+
+void LinearQuadTree::find(Rect r,
+                          vector<TreeNode*>& collection,
+                          int& counter) {
+  flush();
+  find(r, rect, 0, 0, 0, items.size(), collection, counter);
+}
+
+void LinearQuadTree::find(Rect r,
+                          Rect cell,
+                          int depth,
+                          u64 base,
+                          u32 lo,
+                          u32 hi,
+                          vector<TreeNode*>& collection,
+                          int& counter) {
+  counter++;
+
+  if (lo == hi)
+    return;
+
+  if (r.contains(cell)) {
+    for (u32 i = lo; i < hi; i++)
+      collection.push_back(&items[i].node);
+    return;
+  }
+
+  if (!r.overlaps(cell)) {
+    return;
+  }
+
+  if (hi - lo <= SCAN || depth == MAX_DEPTH) {
+    for (u32 i = lo; i < hi; i++)
+      if (r.contains(items[i].node.pos))
+        collection.push_back(&items[i].node);
+    return;
+  }
+
+  const u64 span = u64(1) << (62 - 2 * depth);
+  const vec2 hs = cell.s * 0.5f;
+  const vec2 qs = cell.s * 0.25f;
+  u32 b = lo;
+  for (int c = 0; c < 4; c++) {
+    u32 e = hi;
+    if (c < 3) {
+      Entry k = {base + (c + 1) * span};
+      e = lower_bound(items.begin() + b, items.begin() + hi, k, by_key) -
+          items.begin();
+    }
+    Rect child = {cell.p + vec2{c & 1 ? qs.x : -qs.x, c & 2 ? qs.y : -qs.y},
+                  hs};
+    find(r, child, depth + 1, base + c * span, b, e, collection, counter);
+    b = e;
+  }
+}
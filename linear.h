@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "quadtree.h"
+
+// Quadtree without nodes: entities live in one array sorted by the Z-order
+// key of their position inside `rect`. A cell at depth d is the run of keys
+// sharing its top 2d bits, so descending is a pair of binary searches inside
+// the parent's run and whole cells are read as contiguous slices.
+//
+// Exposes the same operations as QuadTree so the two can be swapped in the
+// frame loop. Inserts are staged and merged in on the next read.
+struct LinearQuadTree {
+  struct Entry {
+    u64 key;
+    TreeNode node;
+  };
+
+  // Cells with at most this many entries are scanned instead of split.
+  static constexpr u32 SCAN = 16;
+  static constexpr int MAX_DEPTH = 32;
+
+  Rect rect;
+  std::vector<Entry> items;
+  std::vector<Entry> pending;
+
+  LinearQuadTree(Rect rect = {{0, 0}, {2048.f, 2048.f}}) : rect(rect) {}
+
+  u64 key(vec2 v) const;
+
+  void insert(TreeNode v, std::vector<TreeNode>& buf);
+  void flush();
+
+  void erase(Rect r);
+  void erase_down();
+
+  void update(f32 dt, std::vector<TreeNode>& v);
+
+  void collect(std::vector<TreeNode*>& collection);
+  void find(Rect r, std::vector<TreeNode*>& collection, int& counter);
+
+  void find(Rect r,
+            Rect cell,
+            int depth,
+            u64 base,
+            u32 lo,
+            u32 hi,
+            std::vector<TreeNode*>& collection,
+            int& counter);
+};
@@ -0,0 +1,89 @@
+#include "morton.h"
+
+#include <array>
+#include <utility>
+
+using namespace std;
+
+using Counts = array<size_t, 256>;
+
+void radix_sort(vector<MortonKey>& keys, Jobs* jobs) {
+  const size_t n = keys.size();
+  // Slices below this are not worth a task.
+  constexpr size_t GRAIN = 1 << 14;
+  const u32 parts =
+      jobs ? std::max<u32>(std::min<size_t>(jobs->size() * 4, n / GRAIN), 1)
+           : 1;
+  const size_t step = (n + parts - 1) / parts;
+
+  auto each = [&](auto&& f) {
+    if (parts == 1) {
+      f(0, 0, n);
+      return;
+    }
+    atomic<int> pending = 0;
+    for (u32 p = 1; p < parts; p++)
+      jobs->spawn(pending, [&, p] {
+        f(p, p * step, std::min(n, (p + 1) * step));
+      });
+    f(0, 0, step);
+    jobs->wait(pending);
+  };
+
+  // Which bytes vary, from one read of the input.
+  vector<array<Counts, 8>> all(parts);
+  each([&](u32 p, size_t lo, size_t hi) {
+    for (auto& c : all[p])
+      c.fill(0);
+    for (size_t i = lo; i < hi; i++)
+      for (int b = 0; b < 8; b++)
+        all[p][b][keys[i].key >> 8 * b & 255]++;
+  });
+
+  vector<MortonKey> tmp(n);
+  MortonKey* src = keys.data();
+  MortonKey* dst = tmp.data();
+  vector<Counts> count(parts);
+
+  for (int b = 0; b < 8; b++) {
+    bool same = false;
+    for (int d = 0; d < 256 && !same; d++) {
+      size_t t = 0;
+      for (u32 p = 0; p < parts; p++)
+        t += all[p][b][d];
+      same = t == n;
+    }
+    if (same)
+      continue;
+
+    // The slices of src changed in the last pass, so count them again. A
+    // single slice is the whole array, whose counts no pass changes.
+    if (parts == 1)
+      count[0] = all[0][b];
+    else
+      each([&](u32 p, size_t lo, size_t hi) {
+        count[p].fill(0);
+        for (size_t i = lo; i < hi; i++)
+          count[p][src[i].key >> 8 * b & 255]++;
+      });
+
+    // Digit-major, slice-minor offsets keep the sort stable.
+    size_t at = 0;
+    for (int d = 0; d < 256; d++)
+      for (u32 p = 0; p < parts; p++) {
+        const size_t c = count[p][d];
+        count[p][d] = at;
+        at += c;
+      }
+
+    each([&](u32 p, size_t lo, size_t hi) {
+      auto& o = count[p];
+      for (size_t i = lo; i < hi; i++)
+        dst[o[src[i].key >> 8 * b & 255]++] = src[i];
+    });
+    swap(src, dst);
+  }
+
+  if (src != keys.data())
+    keys.swap(tmp);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+
+#include "jobs.h"
+#include "vec.h"
+
+// Spreads the low 32 bits of x over the even bits of the result.
+inline u64 part1by1(u64 x) {
+  x &= 0xffffffff;
+  x = (x | (x << 16)) & 0x0000ffff0000ffff;
+  x = (x | (x << 8)) & 0x00ff00ff00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0f;
+  x = (x | (x << 2)) & 0x3333333333333333;
+  x = (x | (x << 1)) & 0x5555555555555555;
+  return x;
+}
+
+inline u64 morton(u32 x, u32 y) {
+  return part1by1(x) | part1by1(y) << 1;
+}
+
+struct MortonKey {
+  u64 key;
+  u32 index;
+};
+
+// Stable sort by key, eight bits per pass from the bottom. A pass is skipped
+// when every key has the same byte there. With jobs, each pass counts and
+// scatters slices of the array in parallel.
+void radix_sort(std::vector<MortonKey>& keys, Jobs* jobs = 0);
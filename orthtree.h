@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "quadtree.h"
+#include "quadtree.inl"
+
+// Axis-aligned box in n dimensions, kept as centre and full size like Rect,
+// and the cell of an Orthtree. Children are numbered by bits: bit k of a
+// child's index is set when it lies on the upper side of axis k, so there
+// are 2^n of them and the index of the child holding a point is built one
+// comparison per axis.
+template <class Scalar, int n>
+struct Box {
+  using vt = vec<Scalar, n>;
+
+  static constexpr int DIM = n;
+  static constexpr int KIDS = 1 << n;
+
+  vt p = {};
+  vt s = {};
+
+  // Half-open, so a point on a split line belongs to exactly the child that
+  // child_index picks for it.
+  bool contains(vt v) const {
+    for (int k = 0; k < n; k++)
+      if (v[k] < p[k] - s[k] / 2 || !(v[k] < p[k] + s[k] / 2))
+        return false;
+    return true;
+  }
+
+  bool contains(const Box& b) const {
+    for (int k = 0; k < n; k++)
+      if (!(p[k] - s[k] / 2 < b.p[k] - b.s[k] / 2) ||
+          !(p[k] + s[k] / 2 > b.p[k] + b.s[k] / 2))
+        return false;
+    return true;
+  }
+
+  bool overlaps(const Box& b) const {
+    for (int k = 0; k < n; k++)
+      if (!(p[k] - s[k] / 2 < b.p[k] + b.s[k] / 2) ||
+          !(b.p[k] - b.s[k] / 2 < p[k] + s[k] / 2))
+        return false;
+    return true;
+  }
+
+  // Squared distance from v to the closest point of the box, 0 inside.
+  Scalar distance2(vt v) const {
+    Scalar r = 0;
+    for (int k = 0; k < n; k++) {
+      Scalar d = fabs(v[k] - p[k]) - s[k] / 2;
+      r += d > 0 ? d * d : 0;
+    }
+    return r;
+  }
+
+  // Squared distance between the closest points of two boxes.
+  Scalar distance2(const Box& b) const {
+    Scalar r = 0;
+    for (int k = 0; k < n; k++) {
+      Scalar d = fabs(b.p[k] - p[k]) - (s[k] + b.s[k]) / 2;
+      r += d > 0 ? d * d : 0;
+    }
+    return r;
+  }
+
+  int child_index(vt v) const {
+    int i = 0;
+    for (int k = 0; k < n; k++)
+      i |= (v[k] >= p[k]) << k;
+    return i;
+  }
+
+  static int child_at(u32 bits) { return bits; }
+
+  void divide(Box r[KIDS]) const {
+    for (int i = 0; i < KIDS; i++)
+      for (int k = 0; k < n; k++) {
+        r[i].s[k] = s[k] / 2;
+        r[i].p[k] = p[k] + (i >> k & 1 ? s[k] : -s[k]) / 4;
+      }
+  }
+};
+
+// n-dimensional sphere, usable as a query shape.
+template <class Scalar, int n>
+struct Ball {
+  using vt = vec<Scalar, n>;
+
+  vt c = {};
+  Scalar r = 0;
+
+  bool contains(vt v) const {
+    Scalar d = 0;
+    for (int k = 0; k < n; k++)
+      d += (v[k] - c[k]) * (v[k] - c[k]);
+    return d <= r * r;
+  }
+
+  // True when the corner furthest from the centre is inside.
+  bool contains(const Box<Scalar, n>& b) const {
+    Scalar d = 0;
+    for (int k = 0; k < n; k++) {
+      const Scalar e = fabs(c[k] - b.p[k]) + b.s[k] / 2;
+      d += e * e;
+    }
+    return d <= r * r;
+  }
+
+  bool overlaps(const Box<Scalar, n>& b) const {
+    return b.distance2(c) <= r * r;
+  }
+};
+
+// Point entity with a velocity, TreeNode in n dimensions.
+template <class Scalar, int n>
+struct Body {
+  vec<Scalar, n> pos = {};
+  vec<Scalar, n> vel = {};
+
+  void update(Scalar dt) {
+    for (int k = 0; k < n; k++)
+      pos[k] += vel[k] * dt;
+  }
+};
+
+// TreePolicy over Box cells, for Orthtree.
+template <class Scalar, int n, class Payload>
+struct OrthPolicy : TreePolicy {
+  using Cell = Box<Scalar, n>;
+
+  static Cell root() {
+    Cell b;
+    for (int k = 0; k < n; k++)
+      b.s[k] = 2048;
+    return b;
+  }
+
+  static vec<Scalar, n> pos(NoContext, const Payload& e) { return e.pos; }
+};
+
+// BasicOrthtree over Box cells: a quadtree at n = 2 and an octree at n = 3.
+// It is the same tree as QuadTree, only the cell differs, so it has the whole
+// dimension-generic API, but not the 2D queries or build that need Rect.
+template <class Scalar,
+          int n,
+          class Payload = Body<Scalar, n>,
+          class Policy = OrthPolicy<Scalar, n, Payload>>
+using Orthtree = BasicOrthtree<Payload, Policy>;
+
+using Octree = Orthtree<f32, 3>;
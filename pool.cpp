@@ -0,0 +1,39 @@
+#include "pool.h"
+
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+void* chunk_alloc(u64 size, bool huge) {
+#ifdef __linux__
+  void* p = MAP_FAILED;
+  if (huge)
+    p = mmap(0, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+  if (p == MAP_FAILED) {
+    p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+             0);
+    if (p == MAP_FAILED)
+      throw std::bad_alloc();
+    // No reserved huge pages, ask for transparent ones instead.
+    if (huge)
+      madvise(p, size, MADV_HUGEPAGE);
+  }
+  return p;
+#else
+  (void)huge;
+  return ::operator new(size);
+#endif
+}
+
+void chunk_free(void* p, u64 size) {
+#ifdef __linux__
+  munmap(p, size);
+#else
+  (void)size;
+  ::operator delete(p);
+#endif
+}
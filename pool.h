@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "vec.h"
+
+void* chunk_alloc(u64 size, bool huge);
+void chunk_free(void* p, u64 size);
+
+// Hands out blocks of N contiguous, uninitialised T's carved from large
+// chunks. Released blocks go on an intrusive free list and are reused before
+// another chunk is requested, so steady-state churn never reaches the global
+// allocator. Set `huge` before the first alloc to back chunks with huge pages
+// where the platform allows it. alloc and free may be called from several
+// threads; a spin lock guards the lists.
+template <class T, int N>
+struct Pool {
+  static constexpr u64 CHUNK = 2 << 20;
+
+  union Block {
+    Block* next;
+    alignas(T) u8 mem[sizeof(T) * N];
+  };
+
+  static constexpr u64 PER_CHUNK = CHUNK / sizeof(Block);
+
+  bool huge = false;
+  Block* free_list = 0;
+  Block* bump = 0;
+  Block* bump_end = 0;
+  std::vector<void*> chunks;
+  u64 live = 0;
+  std::atomic_flag busy = ATOMIC_FLAG_INIT;
+
+  Pool() = default;
+  Pool(const Pool&) = delete;
+  Pool& operator=(const Pool&) = delete;
+
+  ~Pool() {
+    for (auto c : chunks)
+      chunk_free(c, CHUNK);
+  }
+
+  void lock() {
+    while (busy.test_and_set(std::memory_order_acquire))
+      ;
+  }
+
+  void unlock() { busy.clear(std::memory_order_release); }
+
+  T* alloc() {
+    lock();
+    live++;
+    Block* b = free_list;
+    if (b) {
+      free_list = b->next;
+    } else {
+      if (bump == bump_end) {
+        void* c = chunk_alloc(CHUNK, huge);
+        chunks.push_back(c);
+        bump = (Block*)c;
+        bump_end = bump + PER_CHUNK;
+      }
+      b = bump++;
+    }
+    unlock();
+    return (T*)b->mem;
+  }
+
+  void free(T* p) {
+    Block* b = (Block*)p;
+    lock();
+    live--;
+    b->next = free_list;
+    free_list = b;
+    unlock();
+  }
+};
@@ -0,0 +1,4 @@
+#include "quadtree.inl"
+
+template struct BasicOrthtree<TreeNode>;
+template struct BasicOrthtree<TreeNode, FixedTreePolicy>;
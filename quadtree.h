@@ -0,0 +1,654 @@
+#pragma once
+
+#include <atomic>
+#include <concepts>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "bucket.h"
+#include "jobs.h"
+#include "morton.h"
+#include "pool.h"
+#include "vec.h"
+
+constexpr f32 LO = 1.f / f32(1 << 16);
+
+struct TreeNode {
+  vec2 pos = {0, 0};
+  vec2 vel = {0, 0};
+
+  void update(f32 dt) { pos += vel * dt; }
+};
+
+struct Range {
+  vec2 lo, hi;
+  bool contains(Range r) const {
+    return lo.x < r.lo.x && lo.y < r.lo.y && hi.x > r.hi.x && hi.y > r.hi.y;
+  }
+
+  bool overlaps(Range r) const {
+    return lo.x < r.hi.x && r.lo.x < hi.x && lo.y < r.hi.y && r.lo.y < hi.y;
+  }
+};
+
+// The cell of a quadtree. Children are numbered counter-clockwise from the
+// upper right one, as divide lays them out.
+struct Rect {
+  using vt = vec2;
+
+  static constexpr int DIM = 2;
+  static constexpr int KIDS = 4;
+
+  vec2 p = {0, 0};
+  vec2 s = {0, 0};
+
+  Range range() const { return {p - s * 0.5f, p + s * 0.5f}; }
+
+  bool contains(Rect r) const { return range().contains(r.range()); }
+  // Half-open, so a point on a split line belongs to exactly the child that
+  // child_index picks for it.
+  bool contains(vec2 v) const {
+    const Range r = range();
+    return r.lo.x <= v.x && r.lo.y <= v.y && v.x < r.hi.x && v.y < r.hi.y;
+  }
+  bool overlaps(Rect r) const { return range().overlaps(r.range()); }
+
+  // Slab test of the ray o + t * d, with inv = 1 / d, against the rect grown
+  // by pad on every side. On a hit in [0, t_max], t is where the ray enters.
+  bool intersect(vec2 o, vec2 inv, f32 pad, f32 t_max, f32& t) const {
+    const Range g = range();
+    const f32 x0 = (g.lo.x - pad - o.x) * inv.x;
+    const f32 x1 = (g.hi.x + pad - o.x) * inv.x;
+    const f32 y0 = (g.lo.y - pad - o.y) * inv.y;
+    const f32 y1 = (g.hi.y + pad - o.y) * inv.y;
+    t = fmaxf(fmaxf(fminf(x0, x1), fminf(y0, y1)), 0.f);
+    return t <= fminf(fminf(fmaxf(x0, x1), fmaxf(y0, y1)), t_max);
+  }
+
+  // Squared distance from v to the closest point of the rect, 0 inside.
+  f32 distance2(vec2 v) const {
+    const f32 dx = fmaxf(fabsf(v.x - p.x) - s.x * 0.5f, 0.f);
+    const f32 dy = fmaxf(fabsf(v.y - p.y) - s.y * 0.5f, 0.f);
+    return dx * dx + dy * dy;
+  }
+
+  // Squared distance between the closest points of two rects.
+  f32 distance2(Rect r) const {
+    const f32 dx = fmaxf(fabsf(r.p.x - p.x) - (s.x + r.s.x) * 0.5f, 0.f);
+    const f32 dy = fmaxf(fabsf(r.p.y - p.y) - (s.y + r.s.y) * 0.5f, 0.f);
+    return dx * dx + dy * dy;
+  }
+
+  void divide(Rect r[4]) const {
+    const vec2 hs = s * 0.5f;
+    const vec2 qs = s * 0.25f;
+    r[0] = {p + vec2{+qs.x, +qs.y}, hs};
+    r[1] = {p + vec2{-qs.x, +qs.y}, hs};
+    r[2] = {p + vec2{-qs.x, -qs.y}, hs};
+    r[3] = {p + vec2{+qs.x, -qs.y}, hs};
+  }
+
+  int child_index(vec2 v) const {
+    const int x = v.x < p.x;
+    const int y = v.y < p.y;
+    return (x ^ y) + 2 * y;
+  }
+
+  // The child on the upper side of axis k for each bit k that is set.
+  static int child_at(u32 bits) {
+    const u32 x = bits & 1;
+    const u32 y = bits >> 1;
+    return (x ^ y) + 2 * (y ^ 1);
+  }
+};
+
+struct Circle {
+  vec2 c = {0, 0};
+  f32 r = 0;
+
+  bool contains(vec2 v) const {
+    const vec2 d = v - c;
+    return dot(d, d) <= r * r;
+  }
+
+  // True when the corner furthest from the centre is inside.
+  bool contains(Rect q) const {
+    const f32 dx = fabsf(c.x - q.p.x) + q.s.x * 0.5f;
+    const f32 dy = fabsf(c.y - q.p.y) + q.s.y * 0.5f;
+    return dx * dx + dy * dy <= r * r;
+  }
+
+  bool overlaps(Rect q) const { return q.distance2(c) <= r * r; }
+};
+
+
+// Context of policies that need nothing besides the payload.
+struct NoContext {};
+
+// Compile-time shape of a BasicOrthtree. Custom trees derive from it and
+// shadow what differs; pos tells the tree where a payload is.
+struct TreePolicy {
+  // The cell every node covers, which also fixes the dimension and the
+  // number of children.
+  using Cell = Rect;
+  // Passed to pos and placed along with the payload, for payloads that are
+  // only meaningful against some outside state, like an index into a store.
+  // Each tree keeps its own, set on the root and inherited by every node.
+  using Context = NoContext;
+
+  // Entities a leaf keeps inside the node before its bucket spills.
+  static constexpr u32 INLINE = 4;
+  // A leaf splits once it holds more than this many entities.
+  static constexpr u32 CAPACITY = 4;
+  // Read the capacity from leaf_capacity instead, so it can be tuned at run
+  // time at the cost of a load on every split test.
+  static constexpr bool TUNABLE = false;
+  // Cells this many halvings smaller than root() never split, however far
+  // the root has grown since.
+  static constexpr u32 MAX_DEPTH = 32;
+  // Cells smaller than this never split.
+  static constexpr f32 MIN_SIZE = LO;
+  // Descend by bits of the position quantised once against the starting
+  // cell instead of comparing against every centre on the way.
+  static constexpr bool FIXED = false;
+  // Grow the root to take entities outside it instead of dropping them, and
+  // let erase_down shrink it again, never below root().
+  static constexpr bool GROW = true;
+
+  static Rect root() { return {{0, 0}, {2048.f, 2048.f}}; }
+
+  static vec2 pos(Context, const TreeNode& e) { return e.pos; }
+
+  // Whether a leaf at level holding n entities splits to take one more.
+  static bool split(u32 n, u32 capacity, u32 level) { return n >= capacity; }
+
+  // Called whenever e is stored in leaf, or leaf's entities move to another
+  // node, for payloads that keep track of where they are.
+  template <class Node, class Payload>
+  static void placed(Context, const Payload& e, Node& leaf) {}
+};
+
+// Policies whose cells are Rects get the 2D-only queries and the bulk build.
+template <class Policy>
+concept Planar = std::same_as<typename Policy::Cell, Rect>;
+
+struct FixedTreePolicy : TreePolicy {
+  static constexpr bool FIXED = true;
+};
+
+// Kept by the caller of BasicOrthtree::step from one frame to the next. A
+// mover is an entity that left its leaf during the frame; once the share of
+// movers passes threshold, the next frame rebuilds the tree from scratch
+// instead of repairing it.
+struct FrameStats {
+  // Off by default: in quad_bench's step table repair still beats a rebuild
+  // at 97% movers on two threads, so no share measured so far pays for one.
+  // Set it below 1 where a measurement on the target machine says otherwise.
+  f32 threshold = 2.f;
+  // The last frame.
+  u32 entities = 0;
+  u32 movers = 0;
+  bool rebuilt = false;
+  // Running totals.
+  u64 frames = 0;
+  u64 rebuilds = 0;
+
+  f32 ratio() const { return entities ? f32(movers) / f32(entities) : 0.f; }
+};
+
+template <class T>
+struct RayHit {
+  T* node = 0;
+  f32 t = 0;
+};
+
+// The n children of a split node. They are allocated together as one block
+// from the tree's pool and released together.
+template <class Node, int n>
+struct Kids {
+  Node* q = 0;
+
+  Node* begin() const { return q; }
+  Node* end() const { return q + n; }
+  Node& operator[](int i) const { return q[i]; }
+};
+
+template <class F, class T>
+inline bool visit_one(F& f, T& e) {
+  if constexpr (std::is_void_v<decltype(f(e))>) {
+    f(e);
+    return true;
+  } else {
+    return f(e);
+  }
+}
+
+// A tree over Policy::Cell: a quadtree with Rect cells, and an octree or
+// higher with the Box cells of orthtree.h. Dividing, child indexing and
+// containment all come from the cell, so the core below names no axis; the
+// queries and the bulk build that only exist in 2D are constrained to
+// Planar policies.
+//
+// Payload is what the leaves store, read through Policy::pos. Members that
+// move entities (update, gravity) also need Payload to have update(dt) and
+// vel, but are only instantiated when used. The out-of-line members are in
+// quadtree.inl: QuadTree itself is instantiated once in quadtree.cpp, and a
+// translation unit that wants another instantiation includes that file.
+template <class Payload, class Policy = TreePolicy>
+struct BasicOrthtree {
+  using Cell = typename Policy::Cell;
+  using vt = typename Cell::vt;
+  using uvt = vec<u32, Cell::DIM>;
+  using Items = Bucket<Payload, Policy::INLINE>;
+  using Children = Kids<BasicOrthtree, Cell::KIDS>;
+  using Context = typename Policy::Context;
+
+  static constexpr int DIM = Cell::DIM;
+  static constexpr int KIDS = Cell::KIDS;
+
+  Cell rect;
+  BasicOrthtree* parent;
+
+  // A node is split when kids is set, a leaf when it holds items, and empty
+  // otherwise. kids is published with a release store by insert_concurrent,
+  // so a thread that sees it also sees the children.
+  Children kids;
+  Items items;
+  // Entities in this subtree, kept up to date by every mutation.
+  u32 total = 0;
+  // Spin lock taken by insert_concurrent while it changes a leaf.
+  u32 busy = 0;
+  // Set on every node that lost entities since the last erase_down, so
+  // compaction only follows paths where something was removed. Each node
+  // sets its own flag during the mutation's recursion, which keeps the
+  // parallel update free of shared writes.
+  bool dirty = false;
+  // Distance from the root, passed to Policy::split.
+  u8 level = 0;
+  // The root's, copied into every node so any of them can call pos.
+  [[no_unique_address]] Context context = {};
+  // Centre of mass of the subtree, refreshed by aggregate(). Entities have
+  // unit mass, so total doubles as the subtree's mass.
+  vt com = {};
+
+  static Pool<BasicOrthtree, KIDS> pool;
+  // Policy::CAPACITY, or leaf_capacity for TUNABLE policies. Leaves at the
+  // minimum cell size never split and keep growing instead.
+  static u32 capacity() {
+    if constexpr (Policy::TUNABLE)
+      return leaf_capacity;
+    else
+      return Policy::CAPACITY;
+  }
+  // Starts at Policy::CAPACITY. Only read when Policy::TUNABLE is set.
+  static u32 leaf_capacity;
+
+  BasicOrthtree(BasicOrthtree* parent = 0, Cell rect = Policy::root())
+      : rect(rect), parent(parent), level(parent ? parent->level + 1 : 0) {
+    if (parent)
+      context = parent->context;
+  }
+
+  BasicOrthtree(const BasicOrthtree&) = delete;
+  BasicOrthtree& operator=(const BasicOrthtree&) = delete;
+
+  ~BasicOrthtree() { clear(); }
+
+  Items* leaf() { return !kids.q && items.size() ? &items : 0; }
+
+  Children* split() { return kids.q ? &kids : 0; }
+
+  bool is_none() { return !kids.q && !items.size(); }
+
+  // Cells are not split below MIN_SIZE or MAX_DEPTH levels under root(),
+  // nor once their quarter size gets too close to the float spacing at their
+  // centre for the child bounds to stay exact. The depth is measured by size
+  // rather than level, which counts from a root that may have grown.
+  bool at_min_size() const {
+    f32 m = 0;
+    for (int k = 0; k < DIM; k++)
+      m = fmaxf(m, fabsf(rect.p[k]));
+    const f32 deepest = ldexpf(Policy::root().s[0], -int(Policy::MAX_DEPTH));
+    return rect.s[0] < Policy::MIN_SIZE || rect.s[0] <= deepest ||
+           rect.s[0] < m * (1.f / f32(1 << 16));
+  }
+
+  Children divide();
+  void clear();
+  // Hands this node's contents to c, which takes its place in the tree.
+  void move_to(BasicOrthtree& c);
+  void shift_level(int d);
+
+  // On the root only. grow doubles the root towards p until it contains p;
+  // the old root's contents become one child of the new root. shrink undoes
+  // that while every entity sits in a single child, and puts an empty root
+  // back at root(). Both move whole subtrees, never entities, and keep the
+  // root at the same address. grow returns false for positions too far out
+  // to reach.
+  bool grow(vt p);
+  void shrink();
+
+  // Entities outside the root grow it when Policy::GROW is set, and are
+  // dropped otherwise.
+  void insert(Payload v, std::vector<Payload>& buf);
+  // Replaces the contents of the tree, which must be a root, with v. Each
+  // position is quantised against the root once and the Morton keys are
+  // radix-sorted; the nodes are then laid out top-down over the sorted run,
+  // each finding its children's runs by binary search on two key bits. For
+  // the same root, the result is the tree inserting v one by one would give,
+  // though a growing root may settle elsewhere than it would. With jobs,
+  // the sort runs in parallel and subtrees of at least grain entities are
+  // built as separate tasks.
+  void build(std::span<const Payload> v, Jobs* jobs = 0, u32 grain = 4096)
+    requires Planar<Policy>;
+  void build(const MortonKey* keys,
+             size_t n,
+             const Payload* v,
+             int shift,
+             Jobs* jobs,
+             u32 grain)
+    requires Planar<Policy>;
+
+  // insert that may run on several threads at once, but not alongside any
+  // other mutation or query. It never grows the root. Descending is
+  // lock-free: each level reads the child pointer with an acquire load. Only
+  // the leaf being appended to or split is locked, and a split publishes its
+  // children with one release store, so inserts into other leaves never
+  // wait.
+  void insert_concurrent(Payload v);
+  void lock();
+  void unlock();
+  int child_index(vt v) const { return rect.child_index(v); }
+  // v relative to this cell in 32-bit fixed point per axis. Bit 31 - j of
+  // every coordinate picks the child j levels down, so a whole descent path
+  // is read off one quantisation: the Morton code of f, DIM bits at a time.
+  uvt fixed(vt v) const;
+  // The child at bit b of f, in child_index's order.
+  static int quadrant(const uvt& f, u32 b) {
+    u32 bits = 0;
+    for (int k = 0; k < DIM; k++)
+      bits |= (f[k] >> b & 1) << k;
+    return Cell::child_at(bits);
+  }
+  // The child holding p on a descent from here. With Policy::FIXED it is
+  // bit b - 1 of f, and f is quantised against this cell whenever b runs
+  // out: first at the top of the descent, and again every 32 levels on the
+  // deeper paths a grown root leaves. Start descents with b = 0.
+  int child_of(vt p, uvt& f, u32& b) const {
+    if constexpr (Policy::FIXED) {
+      if (!b) {
+        f = fixed(p);
+        b = 32;
+      }
+      return quadrant(f, --b);
+    } else {
+      return child_index(p);
+    }
+  }
+  bool has_children();
+
+  // Collapses split nodes left without entities, walking dirty paths only.
+  // On the root it then shrinks the tree if the world has contracted.
+  void erase_down();
+  void erase_up();
+  void erase();
+  // Returns the number of entities removed.
+  u32 erase(const Cell& r);
+
+  // Both return the number of entities that left their leaf.
+  u32 update(f32 dt, std::vector<Payload>& v);
+  // Same as update, with subtrees of at least grain entities run in parallel.
+  u32 update(f32 dt, std::vector<Payload>& v, Jobs& jobs, u32 grain = 4096);
+  void settle(std::vector<Payload>& v, size_t mark);
+  // Called on the leaf holding v once v has moved. Takes v out and puts it
+  // back through the lowest ancestor that still contains it, so nothing is
+  // searched for and only the path between the two is touched.
+  void relocate(Payload v)
+    requires std::equality_comparable<Payload>;
+  // Called on the leaf holding v. Removes v and takes it off the totals up
+  // to the root; empty cells are collapsed by the next erase_down.
+  void unlink(Payload v)
+    requires std::equality_comparable<Payload>;
+  void take(Payload v)
+    requires std::equality_comparable<Payload>;
+  // One whole frame on the root: integrate, put every entity back in place
+  // and compact. Repairs the tree with update, reinsertion and erase_down,
+  // or, when the last frame's mover share in stats passed its threshold,
+  // integrates everything into a flat array and builds the tree again.
+  // Entities the root cannot take are appended to v.
+  void step(f32 dt,
+            std::vector<Payload>& v,
+            FrameStats& stats,
+            Jobs* jobs = 0)
+    requires Planar<Policy>;
+  // Integrates every entity and appends it to v. Returns the number that
+  // left their leaf.
+  u32 drain(f32 dt, std::vector<Payload>& v);
+
+  void collect(std::vector<Payload*>& collection);
+  // Walks the subtree and returns false if a total disagrees with the
+  // entities below it, a child's parent, level or cell is not what its
+  // parent would give it, or an entity lies outside its leaf's cell.
+  bool check();
+  int size();
+  int depth();
+  u32 count() const { return total; }
+  void find(const Cell& r, std::vector<Payload*>& collection, int& counter);
+
+  // Runs many rectangle queries in one descent, appending the hits of
+  // rects[i] to collections[i]. Each node tests every query that reached it
+  // against all four children at once and passes each child only the
+  // queries that still partially overlap it.
+  void find_batch(std::span<const Rect> rects,
+                  std::vector<std::vector<Payload*>>& collections)
+    requires Planar<Policy>;
+  void find_batch(const Range* ranges,
+                  std::vector<u32>& ids,
+                  size_t lo,
+                  size_t hi,
+                  std::vector<std::vector<Payload*>>& out)
+    requires Planar<Policy>;
+
+  // Entities within r of center. Cells the circle covers completely are
+  // taken whole through collect().
+  void find_radius(vec2 center, f32 r, std::vector<Payload*>& collection)
+    requires Planar<Policy>;
+
+  // First entity, treated as a disc of the given radius, hit by the ray
+  // origin + t * dir for t in [0, max_t]. Cells are walked front to back and
+  // the walk stops at the first cell entered beyond the best hit. Returns a
+  // null node when nothing is hit.
+  RayHit<Payload> raycast(vec2 origin, vec2 dir, f32 max_t, f32 radius)
+    requires Planar<Policy>;
+
+  // Entities within radius of the segment ab, in front-to-back cell order.
+  void segment_query(vec2 a,
+                     vec2 b,
+                     f32 radius,
+                     std::vector<Payload*>& collection)
+    requires Planar<Policy>;
+
+  template <class F>
+  void trace(vec2 o, vec2 inv, f32 pad, f32& t_max, F& f)
+    requires Planar<Policy>;
+
+  // The k entities closest to p, nearest first. Cells are opened best-first
+  // by their distance to p and skipped once they are further away than the
+  // current k-th candidate.
+  void nearest(vt p, u32 k, std::vector<Payload*>& collection);
+
+  // Calls f on every entity inside shape. Shape needs contains(Cell),
+  // overlaps(Cell) and contains(vt), so Cell itself works. f may return
+  // false to stop early, in which case query returns false too.
+  template <class Shape, class F>
+  bool query(const Shape& shape, F&& f);
+
+  // Calls f on every entity in this subtree, with the same early exit.
+  template <class F>
+  bool visit(F&& f);
+
+  // Recomputes com bottom-up. Run after update or inserts, before reading it.
+  void aggregate();
+
+  // Barnes-Hut gravity: adds dt times each entity's acceleration to its vel.
+  // A cell whose size over distance is below theta acts as a point mass at
+  // its com. soft is the Plummer softening length, and may be 0.
+  void gravity(f32 dt, f32 theta = 0.5f, f32 g = 1.f, f32 soft = 1e-3f);
+  vt accel(vt p, f32 tt, f32 g, f32 ss);
+
+  // Calls f(a, b) once for every unordered pair of entities at most radius
+  // apart. Works as a self-join: each cell is paired with itself and with
+  // every other cell within radius of it, so no entity is looked up twice.
+  template <class F>
+  void for_each_pair(f32 radius, F&& f);
+
+  template <class F>
+  void pairs_self(f32 rr, F& f);
+
+  template <class F>
+  static void pairs_cross(BasicOrthtree& a, BasicOrthtree& b, f32 rr, F& f);
+
+  // Number of entities inside shape. Subtrees fully inside it are answered
+  // from their cached total without being visited.
+  template <class Shape>
+  u32 count(const Shape& shape);
+};
+
+template <class Payload, class Policy = TreePolicy>
+using BasicQuadTree = BasicOrthtree<Payload, Policy>;
+
+using QuadTree = BasicQuadTree<TreeNode>;
+using FixedQuadTree = BasicQuadTree<TreeNode, FixedTreePolicy>;
+
+extern template struct BasicOrthtree<TreeNode>;
+extern template struct BasicOrthtree<TreeNode, FixedTreePolicy>;
+
+template <class Payload, class Policy>
+template <class F>
+bool BasicOrthtree<Payload, Policy>::visit(F&& f) {
+  if (auto c = leaf()) {
+    for (auto& e : *c)
+      if (!visit_one(f, e))
+        return false;
+    return true;
+  }
+
+  if (auto c = split())
+    for (auto& c : *c)
+      if (!c.visit(f))
+        return false;
+  return true;
+}
+
+template <class Payload, class Policy>
+template <class Shape, class F>
+bool BasicOrthtree<Payload, Policy>::query(const Shape& shape, F&& f) {
+  if (is_none())
+    return true;
+
+  if (shape.contains(rect))
+    return visit(f);
+
+  if (!shape.overlaps(rect))
+    return true;
+
+  if (auto c = leaf()) {
+    for (auto& e : *c)
+      if (shape.contains(Policy::pos(context, e)) && !visit_one(f, e))
+        return false;
+    return true;
+  }
+
+  for (auto& c : *split())
+    if (!c.query(shape, f))
+      return false;
+  return true;
+}
+
+template <class Payload, class Policy>
+template <class Shape>
+u32 BasicOrthtree<Payload, Policy>::count(const Shape& shape) {
+  if (!total)
+    return 0;
+
+  if (shape.contains(rect))
+    return total;
+
+  if (!shape.overlaps(rect))
+    return 0;
+
+  u32 n = 0;
+  if (auto c = leaf()) {
+    for (auto& e : *c)
+      n += shape.contains(Policy::pos(context, e));
+    return n;
+  }
+
+  for (auto& c : *split())
+    n += c.count(shape);
+  return n;
+}
+
+template <class Payload, class Policy>
+template <class F>
+void BasicOrthtree<Payload, Policy>::for_each_pair(f32 radius, F&& f) {
+  pairs_self(radius * radius, f);
+}
+
+template <class Payload, class Policy>
+template <class F>
+void BasicOrthtree<Payload, Policy>::pairs_self(f32 rr, F& f) {
+  if (total < 2)
+    return;
+
+  if (auto c = leaf()) {
+    for (u32 i = 0; i < c->size(); i++)
+      for (u32 j = i + 1; j < c->size(); j++) {
+        const vt d =
+            Policy::pos(context, (*c)[i]) - Policy::pos(context, (*c)[j]);
+        if (dot(d, d) <= rr)
+          f((*c)[i], (*c)[j]);
+      }
+    return;
+  }
+
+  auto& c = *split();
+  for (int i = 0; i < KIDS; i++) {
+    c[i].pairs_self(rr, f);
+    for (int j = i + 1; j < KIDS; j++)
+      pairs_cross(c[i], c[j], rr, f);
+  }
+}
+
+// a and b are disjoint, so every pair between them is reported exactly once.
+template <class Payload, class Policy>
+template <class F>
+void BasicOrthtree<Payload, Policy>::pairs_cross(BasicOrthtree& a,
+                                                 BasicOrthtree& b,
+                                                 f32 rr,
+                                                 F& f) {
+  if (!a.total || !b.total || a.rect.distance2(b.rect) > rr)
+    return;
+
+  auto la = a.leaf();
+  auto lb = b.leaf();
+  if (la && lb) {
+    for (auto& x : *la)
+      for (auto& y : *lb) {
+        const vt d = Policy::pos(a.context, x) - Policy::pos(a.context, y);
+        if (dot(d, d) <= rr)
+          f(x, y);
+      }
+    return;
+  }
+
+  // Open the larger cell, or the only one that is split.
+  if (lb || (!la && a.rect.s[0] >= b.rect.s[0])) {
+    for (auto& c : *a.split())
+      pairs_cross(c, b, rr, f);
+  } else {
+    for (auto& c : *b.split())
+      pairs_cross(a, c, rr, f);
+  }
+}
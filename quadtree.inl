@@ -0,0 +1,1101 @@
+#pragma once
+
+// Out-of-line members of BasicOrthtree. quadtree.cpp instantiates QuadTree
+// from these; include this header to instantiate a tree over another payload
+// or cell.
+
+#include "quadtree.h"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define QUAD_SSE 1
+#endif
+
+template <class Payload, class Policy>
+Pool<BasicOrthtree<Payload, Policy>, BasicOrthtree<Payload, Policy>::KIDS>
+    BasicOrthtree<Payload, Policy>::pool;
+template <class Payload, class Policy>
+u32 BasicOrthtree<Payload, Policy>::leaf_capacity = Policy::CAPACITY;
+
+template <class Payload, class Policy>
+auto BasicOrthtree<Payload, Policy>::divide() -> Children {
+  Cell r[KIDS];
+  rect.divide(r);
+  BasicOrthtree* q = pool.alloc();
+  for (int i = 0; i < KIDS; i++)
+    new (q + i) BasicOrthtree(this, r[i]);
+  return {q};
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::clear() {
+  if (auto c = split()) {
+    BasicOrthtree* q = c->q;
+    for (auto& c : *c)
+      c.~BasicOrthtree();
+    pool.free(q);
+  }
+  kids = {};
+  items.reset();
+  total = 0;
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::insert(Payload v,
+                                            std::vector<Payload>& buf) {
+  const vt p = Policy::pos(context, v);
+  if (!rect.contains(p)) {
+    if (!Policy::GROW || parent || !grow(p))
+      return;
+  }
+
+  uvt f = {};
+  u32 b = 0;
+  BasicOrthtree* q = this;
+  while (q->kids.q) {
+    q->total++;
+    q = &q->kids[q->child_of(p, f, b)];
+  }
+  q->total++;
+
+  if (!Policy::split(q->items.size(), capacity(), q->level) ||
+      q->at_min_size()) {
+    q->items.push(v);
+    Policy::placed(context, v, *q);
+    return;
+  }
+
+  Items old = std::move(q->items);
+  Children tmp = q->divide();
+  q->kids = tmp;
+  for (auto& c : old)
+    tmp[q->child_index(Policy::pos(context, c))].insert(c, buf);
+  tmp[q->child_index(p)].insert(v, buf);
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::build(std::span<const Payload> v,
+                                           Jobs* jobs,
+                                           u32 grain)
+  requires Planar<Policy> {
+  clear();
+
+  if (Policy::GROW) {
+    rect = Policy::root();
+    for (auto& e : v)
+      grow(Policy::pos(context, e));
+  }
+
+  std::vector<MortonKey> keys;
+  keys.reserve(v.size());
+  for (u32 i = 0; i < v.size(); i++) {
+    const vec2 p = Policy::pos(context, v[i]);
+    if (!rect.contains(p))
+      continue;
+    const uvec2 f = fixed(p);
+    keys.push_back({morton(f.x, f.y), i});
+  }
+
+  radix_sort(keys, jobs);
+  build(keys.data(), keys.size(), v.data(), 62, jobs, grain);
+}
+
+// keys[0, n) are this cell's entities in Morton order. Bits shift and
+// shift + 1 of a key hold its x and y side of this cell's split lines. Keys
+// run out after 32 levels, so deeper cells key their entities again against
+// their own bounds, like child_of does on a fixed descent.
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::build(const MortonKey* keys,
+                                           size_t n,
+                                           const Payload* v,
+                                           int shift,
+                                           Jobs* jobs,
+                                           u32 grain)
+  requires Planar<Policy> {
+  total = n;
+  if (!n)
+    return;
+
+  if (!Policy::split(n - 1, capacity(), level) || at_min_size()) {
+    for (size_t i = 0; i < n; i++) {
+      items.push(v[keys[i].index]);
+      Policy::placed(context, v[keys[i].index], *this);
+    }
+    return;
+  }
+
+  std::vector<MortonKey> sub;
+  if (shift < 0) {
+    sub.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      const uvec2 f = fixed(Policy::pos(context, v[keys[i].index]));
+      sub[i] = {morton(f.x, f.y), keys[i].index};
+    }
+    radix_sort(sub, jobs);
+    keys = sub.data();
+    shift = 62;
+  }
+
+  Children tmp = divide();
+  kids = tmp;
+
+  std::atomic<int> pending = 0;
+  size_t lo = 0;
+  for (u32 d = 0; d < 4; d++) {
+    const MortonKey* end = std::partition_point(
+        keys + lo, keys + n,
+        [&](const MortonKey& k) { return (k.key >> shift & 3) <= d; });
+    const size_t hi = end - keys;
+    BasicOrthtree& c = tmp[Cell::child_at(d)];
+    const MortonKey* run = keys + lo;
+    const size_t m = hi - lo;
+    if (jobs && m >= grain)
+      jobs->spawn(pending,
+                  [=, &c] { c.build(run, m, v, shift - 2, jobs, grain); });
+    else
+      c.build(run, m, v, shift - 2, jobs, grain);
+    lo = hi;
+  }
+
+  if (jobs)
+    jobs->wait(pending);
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::lock() {
+  std::atomic_ref<u32> b(busy);
+  while (b.exchange(1, std::memory_order_acquire))
+    while (b.load(std::memory_order_relaxed))
+      ;
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::unlock() {
+  std::atomic_ref<u32>(busy).store(0, std::memory_order_release);
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::insert_concurrent(Payload v) {
+  const vt p = Policy::pos(context, v);
+  if (!rect.contains(p)) {
+    return;
+  }
+
+  uvt f = {};
+  u32 b = 0;
+  BasicOrthtree* q = this;
+  for (;;) {
+    std::atomic_ref<u32>(q->total).fetch_add(1, std::memory_order_relaxed);
+
+    BasicOrthtree* k = std::atomic_ref<BasicOrthtree*>(q->kids.q).load(
+        std::memory_order_acquire);
+    if (!k) {
+      q->lock();
+      k = std::atomic_ref<BasicOrthtree*>(q->kids.q).load(
+          std::memory_order_relaxed);
+      if (!k) {
+        if (!Policy::split(q->items.size(), capacity(), q->level) ||
+            q->at_min_size()) {
+          q->items.push(v);
+          Policy::placed(context, v, *q);
+          q->unlock();
+          return;
+        }
+
+        // The children are private until published, so they are filled
+        // with the plain insert.
+        std::vector<Payload> buf;
+        Children tmp = q->divide();
+        for (auto& c : q->items)
+          tmp[q->child_index(Policy::pos(context, c))].insert(c, buf);
+        tmp[q->child_index(p)].insert(v, buf);
+        q->items.reset();
+        std::atomic_ref<BasicOrthtree*>(q->kids.q).store(
+            tmp.q, std::memory_order_release);
+        q->unlock();
+        return;
+      }
+      q->unlock();
+    }
+
+    q = &k[q->child_of(p, f, b)];
+  }
+}
+
+// Computed in double, like LinearQuadTree::key, so that for points inside the
+// cell bit 31 - j is set exactly when the point is on the upper side of the
+// split line j levels below this cell.
+template <class Payload, class Policy>
+auto BasicOrthtree<Payload, Policy>::fixed(vt v) const -> uvt {
+  uvt f;
+  for (int k = 0; k < DIM; k++) {
+    const f32 lo = rect.p[k] - rect.s[k] * 0.5f;
+    const f64 x = (f64(v[k]) - lo) / rect.s[k] * 4294967296.0;
+    f[k] = x <= 0 ? 0 : x >= 4294967295.0 ? 0xffffffff : u32(x);
+  }
+  return f;
+}
+
+template <class Payload, class Policy>
+bool BasicOrthtree<Payload, Policy>::has_children() {
+  bool re = false;
+  if (auto c = split())
+    for (auto& c : *c)
+      re |= !c.is_none();
+  return re;
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::erase_down() {
+  if (!dirty)
+    return;
+  dirty = false;
+
+  if (auto c = split()) {
+    if (!total) {
+      clear();
+      return;
+    }
+    for (auto& c : *c)
+      c.erase_down();
+  }
+
+  if (Policy::GROW && !parent)
+    shrink();
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::move_to(BasicOrthtree& c) {
+  c.kids = kids;
+  c.items = std::move(items);
+  c.total = total;
+  c.dirty = dirty;
+  c.com = com;
+  if (auto k = c.split())
+    for (auto& g : *k)
+      g.parent = &c;
+  for (auto& e : c.items)
+    Policy::placed(context, e, c);
+  kids = {};
+  total = 0;
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::shift_level(int d) {
+  level += d;
+  if (auto c = split())
+    for (auto& c : *c)
+      c.shift_level(d);
+}
+
+// Each step keeps the old rect as a quadrant of one twice its size, so the
+// split lines below stay where they were and nothing has to move.
+template <class Payload, class Policy>
+bool BasicOrthtree<Payload, Policy>::grow(vt p) {
+  // Also rejects NaN.
+  for (int k = 0; k < DIM; k++)
+    if (!(fabsf(p[k]) < 1e30f))
+      return false;
+
+  while (!rect.contains(p)) {
+    Cell big = rect;
+    for (int k = 0; k < DIM; k++) {
+      const f32 h = rect.s[k] * 0.5f;
+      big.p[k] += p[k] < rect.p[k] ? -h : h;
+      big.s[k] *= 2.f;
+    }
+    if (is_none()) {
+      rect = big;
+      continue;
+    }
+
+    const Cell old = rect;
+    rect = big;
+    const bool was_dirty = dirty;
+    Children tmp = divide();
+    BasicOrthtree& c = tmp[child_index(old.p)];
+    move_to(c);
+    if (auto k = c.split())
+      for (auto& g : *k)
+        g.shift_level(1);
+    kids = tmp;
+    total = c.total;
+    dirty = was_dirty;
+  }
+  return true;
+}
+
+// An empty root goes straight back to root(). A leaf root halves towards its
+// entities, telling them their cell got smaller.
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::shrink() {
+  const Cell home = Policy::root();
+  while (rect.s[0] > home.s[0]) {
+    if (is_none()) {
+      rect = home;
+      return;
+    }
+
+    if (auto c = leaf()) {
+      const int i = child_index(Policy::pos(context, (*c)[0]));
+      for (auto& e : *c)
+        if (child_index(Policy::pos(context, e)) != i)
+          return;
+      Cell r[KIDS];
+      rect.divide(r);
+      rect = r[i];
+      for (auto& e : *c)
+        Policy::placed(context, e, *this);
+      continue;
+    }
+
+    BasicOrthtree* only = 0;
+    for (auto& c : kids) {
+      if (!c.total)
+        continue;
+      if (only)
+        return;
+      only = &c;
+    }
+    if (!only)
+      return;
+
+    BasicOrthtree* q = kids.q;
+    const Cell r = only->rect;
+    kids = {};
+    only->move_to(*this);
+    rect = r;
+    for (int i = 0; i < KIDS; i++)
+      q[i].~BasicOrthtree();
+    pool.free(q);
+    if (auto k = split())
+      for (auto& g : *k)
+        g.shift_level(-1);
+  }
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::erase_up() {
+  if (leaf())
+    return;
+
+  if (auto c = split())
+    if (!has_children())
+      clear();
+
+  if (parent) {
+    parent->erase_up();
+  }
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::erase() {
+  const u32 n = total;
+  clear();
+  for (auto p = parent; p; p = p->parent) {
+    p->total -= n;
+    p->dirty = true;
+  }
+  if (parent)
+    parent->erase_up();
+}
+
+template <class Payload, class Policy>
+u32 BasicOrthtree<Payload, Policy>::erase(const Cell& r) {
+  if (is_none())
+    return 0;
+
+  // Flagged for the root's sake: a parent flags itself anyway, but a root
+  // cleared here still has to shrink in erase_down.
+  if (r.contains(rect)) {
+    const u32 n = total;
+    clear();
+    dirty = true;
+    return n;
+  }
+
+  if (!r.overlaps(rect)) {
+    return 0;
+  }
+
+  u32 n = 0;
+  if (auto c = leaf()) {
+    for (u32 i = 0; i < c->size();) {
+      if (r.contains(Policy::pos(context, (*c)[i])))
+        c->remove(i), n++;
+      else
+        i++;
+    }
+    if (!c->size())
+      items.reset();
+    total -= n;
+    dirty |= n > 0;
+    return n;
+  }
+
+  for (auto& c : *split())
+    n += c.erase(r);
+  total -= n;
+  dirty |= n > 0;
+  if (!total)
+    clear();
+  return n;
+}
+
+// Entities that leave a cell are handed up the recursion and reinserted by
+// the first ancestor that contains them, once all of that ancestor's children
+// have been integrated, so nothing moves twice. Whatever leaves the root is
+// returned in v. Cells left empty are collapsed on the way back up.
+template <class Payload, class Policy>
+u32 BasicOrthtree<Payload, Policy>::update(f32 dt, std::vector<Payload>& v) {
+  u32 moved = 0;
+  if (auto c = split()) {
+    const size_t mark = v.size();
+    for (auto& c : *c)
+      moved += c.update(dt, v);
+    settle(v, mark);
+    return moved;
+  }
+
+  if (auto c = leaf()) {
+    for (u32 i = 0; i < c->size();) {
+      auto& e = (*c)[i];
+      e.update(dt);
+      if (!rect.contains(Policy::pos(context, e))) {
+        v.push_back(e);
+        c->remove(i);
+      } else {
+        i++;
+      }
+    }
+    moved = total - c->size();
+    dirty |= moved > 0;
+    total = c->size();
+    if (!c->size())
+      items.reset();
+  }
+  return moved;
+}
+
+// Subtrees with at least grain entities are forked onto the pool. Each fork
+// gathers its children's escapers in buffers of its own and merges them once
+// they have joined, so the reinsertion below a fork stays on one thread and
+// no buffer is shared.
+template <class Payload, class Policy>
+u32 BasicOrthtree<Payload, Policy>::update(f32 dt,
+                                           std::vector<Payload>& v,
+                                           Jobs& jobs,
+                                           u32 grain) {
+  auto c = split();
+  if (!c || total < grain)
+    return update(dt, v);
+
+  std::vector<Payload> sub[KIDS];
+  u32 moved[KIDS] = {};
+  std::atomic<int> pending = 0;
+  for (int i = 1; i < KIDS; i++)
+    jobs.spawn(pending, [&, i] {
+      moved[i] = (*c)[i].update(dt, sub[i], jobs, grain);
+    });
+  moved[0] = (*c)[0].update(dt, sub[0], jobs, grain);
+  jobs.wait(pending);
+
+  const size_t mark = v.size();
+  for (auto& s : sub)
+    v.insert(v.end(), s.begin(), s.end());
+  settle(v, mark);
+  u32 n = 0;
+  for (u32 m : moved)
+    n += m;
+  return n;
+}
+
+// v[mark, end) escaped from this node's children during update. Reinserts
+// the ones this node still contains and leaves the rest for the parent.
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::settle(std::vector<Payload>& v,
+                                            size_t mark) {
+  for (size_t i = mark; i < v.size();) {
+    if (rect.contains(Policy::pos(context, v[i]))) {
+      insert(v[i], v);
+      v[i] = v.back();
+      v.pop_back();
+    } else {
+      i++;
+    }
+  }
+
+  // Reinserting bumped this node's total, so take it from the children.
+  total = 0;
+  for (auto& c : *split()) {
+    total += c.total;
+    dirty |= c.dirty;
+  }
+  if (!total)
+    clear();
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::relocate(Payload v)
+  requires std::equality_comparable<Payload> {
+  take(v);
+
+  // Every node below the one that takes v back loses it; that one loses it
+  // here and counts it again in insert.
+  const vt p = Policy::pos(context, v);
+  BasicOrthtree* n = this;
+  n->total--;
+  while (!n->rect.contains(p) && n->parent) {
+    n = n->parent;
+    n->total--;
+  }
+  std::vector<Payload> buf;
+  n->insert(v, buf);
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::unlink(Payload v)
+  requires std::equality_comparable<Payload> {
+  take(v);
+  for (auto n = this; n; n = n->parent)
+    n->total--;
+}
+
+// Leaves totals alone.
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::take(Payload v)
+  requires std::equality_comparable<Payload> {
+  for (u32 i = 0; i < items.size(); i++)
+    if (items[i] == v) {
+      items.remove(i);
+      break;
+    }
+  // An emptied leaf may leave its parent with nothing below it, so mark the
+  // path for erase_down. A dirty node's ancestors are dirty already.
+  if (!items.size()) {
+    items.reset();
+    for (auto n = this; n && !n->dirty; n = n->parent)
+      n->dirty = true;
+  }
+}
+
+// The mover share is decided by the previous frame because it is only known
+// after integrating, and a frame that has integrated in place has already paid
+// for most of the repair. Motion is coherent enough from frame to frame that
+// the last share is a good guess for the next, and a rebuild frame measures
+// it too, so the choice swings back once things calm down.
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::step(f32 dt,
+                                          std::vector<Payload>& v,
+                                          FrameStats& stats,
+                                          Jobs* jobs)
+  requires Planar<Policy> {
+  stats.rebuilt = stats.ratio() > stats.threshold;
+  stats.entities = total;
+
+  if (stats.rebuilt) {
+    std::vector<Payload> all;
+    all.reserve(total);
+    stats.movers = drain(dt, all);
+    build(all, jobs);
+    for (auto& e : all)
+      if (!rect.contains(Policy::pos(context, e)))
+        v.push_back(e);
+  } else {
+    const size_t mark = v.size();
+    stats.movers = jobs ? update(dt, v, *jobs) : update(dt, v);
+    std::vector<Payload> buf;
+    for (size_t i = mark; i < v.size();) {
+      insert(v[i], buf);
+      if (rect.contains(Policy::pos(context, v[i]))) {
+        v[i] = v.back();
+        v.pop_back();
+      } else {
+        i++;
+      }
+    }
+    erase_down();
+  }
+
+  stats.frames++;
+  stats.rebuilds += stats.rebuilt;
+}
+
+template <class Payload, class Policy>
+u32 BasicOrthtree<Payload, Policy>::drain(f32 dt, std::vector<Payload>& v) {
+  u32 moved = 0;
+  if (auto c = leaf()) {
+    for (auto& e : *c) {
+      e.update(dt);
+      moved += !rect.contains(Policy::pos(context, e));
+      v.push_back(e);
+    }
+  } else if (auto c = split()) {
+    for (auto& c : *c)
+      moved += c.drain(dt, v);
+  }
+  return moved;
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::collect(
+    std::vector<Payload*>& collection) {
+  if (auto c = leaf()) {
+    for (auto& e : *c)
+      collection.push_back(&e);
+    return;
+  }
+
+  if (auto c = split())
+    for (auto& c : *c)
+      c.collect(collection);
+}
+
+template <class Payload, class Policy>
+bool BasicOrthtree<Payload, Policy>::check() {
+  u32 n = 0;
+  if (auto c = leaf()) {
+    for (auto& e : *c)
+      if (!rect.contains(Policy::pos(context, e)))
+        return false;
+    n = c->size();
+  } else if (auto c = split()) {
+    Cell r[KIDS];
+    rect.divide(r);
+    for (int i = 0; i < KIDS; i++) {
+      auto& k = (*c)[i];
+      if (k.parent != this || k.level != level + 1)
+        return false;
+      for (int d = 0; d < DIM; d++)
+        if (k.rect.p[d] != r[i].p[d] || k.rect.s[d] != r[i].s[d])
+          return false;
+      if (!k.check())
+        return false;
+      n += k.total;
+    }
+  }
+  return n == total;
+}
+
+template <class Payload, class Policy>
+int BasicOrthtree<Payload, Policy>::size() {
+  int r = 1;
+  if (auto c = split()) {
+    for (auto& c : *c)
+      r += c.size();
+  }
+
+  return r;
+}
+
+template <class Payload, class Policy>
+int BasicOrthtree<Payload, Policy>::depth() {
+  int r = 0;
+  if (auto c = split()) {
+    for (auto& c : *c)
+      r = std::max(r, c.depth());
+    r++;
+  }
+
+  return r;
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::find(const Cell& r,
+                                          std::vector<Payload*>& collection,
+                                          int& counter) {
+  counter++;
+
+  if (is_none())
+    return;
+
+  if (r.contains(rect)) {
+    collect(collection);
+    return;
+  }
+
+  if (!r.overlaps(rect)) {
+    return;
+  }
+
+  if (auto c = leaf()) {
+    for (auto& e : *c)
+      if (r.contains(Policy::pos(context, e)))
+        collection.push_back(&e);
+    return;
+  }
+
+  for (auto& c : *split())
+    c.find(r, collection, counter);
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::find_radius(
+    vec2 center,
+    f32 r,
+    std::vector<Payload*>& collection)
+  requires Planar<Policy> {
+  const Circle circle = {center, r};
+
+  if (is_none())
+    return;
+
+  if (circle.contains(rect)) {
+    collect(collection);
+    return;
+  }
+
+  if (!circle.overlaps(rect)) {
+    return;
+  }
+
+  if (auto c = leaf()) {
+    for (auto& e : *c)
+      if (circle.contains(Policy::pos(context, e)))
+        collection.push_back(&e);
+    return;
+  }
+
+  for (auto& c : *split())
+    c.find_radius(center, r, collection);
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::aggregate() {
+  vt sum = {};
+  if (auto c = leaf()) {
+    for (auto& e : *c)
+      sum += Policy::pos(context, e);
+  } else if (auto c = split()) {
+    for (auto& c : *c) {
+      c.aggregate();
+      sum += c.com * f32(c.total);
+    }
+  }
+  com = total ? sum / f32(total) : rect.p;
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::gravity(f32 dt,
+                                             f32 theta,
+                                             f32 g,
+                                             f32 soft) {
+  aggregate();
+
+  std::vector<Payload*> all;
+  collect(all);
+  for (auto e : all)
+    e->vel +=
+        accel(Policy::pos(context, *e), theta * theta, g, soft * soft) * dt;
+}
+
+template <class Payload, class Policy>
+auto BasicOrthtree<Payload, Policy>::accel(vt p, f32 tt, f32 g, f32 ss)
+    -> vt {
+  vt a = {};
+  if (!total)
+    return a;
+
+  // Entities at p, p's own among them, are skipped: without softening their
+  // r2 is 0 and the term would be 0 * inf.
+  if (auto c = leaf()) {
+    for (auto& e : *c) {
+      const vt d = Policy::pos(context, e) - p;
+      const f32 r2 = dot(d, d) + ss;
+      if (r2 == 0)
+        continue;
+      a += d * (g / (r2 * sqrtf(r2)));
+    }
+    return a;
+  }
+
+  const vt d = com - p;
+  const f32 r2 = dot(d, d);
+  if (rect.s[0] * rect.s[0] < tt * r2) {
+    const f32 r2s = r2 + ss;
+    return d * (g * f32(total) / (r2s * sqrtf(r2s)));
+  }
+
+  for (auto& c : *split())
+    a += c.accel(p, tt, g, ss);
+  return a;
+}
+
+// The four children of a node as lanes, for testing one query range
+// against all of them at once.
+struct Lanes {
+  alignas(16) f32 lx[4], ly[4], hx[4], hy[4];
+};
+
+// Sets bit i of full when r contains child i (Range::contains) and of part
+// when r overlaps it (Range::overlaps).
+inline void test4(Range r, const Lanes& c, int& full, int& part) {
+#if QUAD_SSE
+  const __m128 lx = _mm_set1_ps(r.lo.x), ly = _mm_set1_ps(r.lo.y);
+  const __m128 hx = _mm_set1_ps(r.hi.x), hy = _mm_set1_ps(r.hi.y);
+  const __m128 clx = _mm_load_ps(c.lx), cly = _mm_load_ps(c.ly);
+  const __m128 chx = _mm_load_ps(c.hx), chy = _mm_load_ps(c.hy);
+  full = _mm_movemask_ps(
+      _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(lx, clx), _mm_cmplt_ps(ly, cly)),
+                 _mm_and_ps(_mm_cmpgt_ps(hx, chx), _mm_cmpgt_ps(hy, chy))));
+  part = _mm_movemask_ps(
+      _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(lx, chx), _mm_cmplt_ps(clx, hx)),
+                 _mm_and_ps(_mm_cmplt_ps(ly, chy), _mm_cmplt_ps(cly, hy))));
+#else
+  full = part = 0;
+  for (int i = 0; i < 4; i++) {
+    const Range q = {{c.lx[i], c.ly[i]}, {c.hx[i], c.hy[i]}};
+    full |= r.contains(q) << i;
+    part |= r.overlaps(q) << i;
+  }
+#endif
+}
+
+// ids[lo, hi) are the queries that partially overlap this node. Each child's
+// share is written past the end of ids and popped again before returning.
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::find_batch(
+    const Range* ranges,
+    std::vector<u32>& ids,
+    size_t lo,
+    size_t hi,
+    std::vector<std::vector<Payload*>>& out)
+  requires Planar<Policy> {
+  if (auto c = leaf()) {
+    for (size_t i = lo; i < hi; i++) {
+      const Range r = ranges[ids[i]];
+      auto& o = out[ids[i]];
+      for (auto& e : *c) {
+        const vec2 p = Policy::pos(context, e);
+        if (r.lo.x <= p.x && r.lo.y <= p.y && p.x < r.hi.x && p.y < r.hi.y)
+          o.push_back(&e);
+      }
+    }
+    return;
+  }
+
+  auto c = split();
+  if (!c)
+    return;
+
+  Lanes lanes;
+  int live = 0;
+  for (int i = 0; i < 4; i++) {
+    const Range r = (*c)[i].rect.range();
+    lanes.lx[i] = r.lo.x, lanes.ly[i] = r.lo.y;
+    lanes.hx[i] = r.hi.x, lanes.hy[i] = r.hi.y;
+    live |= ((*c)[i].total != 0) << i;
+  }
+
+  const size_t n = hi - lo;
+  const size_t base = ids.size();
+  size_t count[4] = {};
+  ids.resize(base + 4 * n);
+
+  for (size_t i = lo; i < hi; i++) {
+    const u32 id = ids[i];
+    int full, part;
+    test4(ranges[id], lanes, full, part);
+    full &= live;
+    part &= live & ~full;
+    for (int k = 0; full >> k; k++)
+      if (full >> k & 1)
+        (*c)[k].collect(out[id]);
+    for (int k = 0; part >> k; k++)
+      if (part >> k & 1)
+        ids[base + k * n + count[k]++] = id;
+  }
+
+  for (int k = 0; k < 4; k++)
+    if (count[k])
+      (*c)[k].find_batch(ranges, ids, base + k * n, base + k * n + count[k],
+                         out);
+  ids.resize(base);
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::find_batch(
+    std::span<const Rect> rects,
+    std::vector<std::vector<Payload*>>& collections)
+  requires Planar<Policy> {
+  collections.resize(rects.size());
+
+  std::vector<Range> ranges(rects.size());
+  std::vector<u32> ids;
+  for (u32 i = 0; i < rects.size(); i++) {
+    ranges[i] = rects[i].range();
+    if (is_none())
+      continue;
+    if (rects[i].contains(rect))
+      collect(collections[i]);
+    else if (rects[i].overlaps(rect))
+      ids.push_back(i);
+  }
+
+  find_batch(ranges.data(), ids, 0, ids.size(), collections);
+}
+
+// Calls f on the leaves whose cell, grown by pad, the ray o + t * d crosses
+// for t in [0, t_max], nearest cell first. f may shrink t_max as it goes.
+template <class Payload, class Policy>
+template <class F>
+void BasicOrthtree<Payload, Policy>::trace(vec2 o,
+                                           vec2 inv,
+                                           f32 pad,
+                                           f32& t_max,
+                                           F& f)
+  requires Planar<Policy> {
+  if (auto c = leaf()) {
+    f(*c);
+    return;
+  }
+
+  auto c = split();
+  if (!c)
+    return;
+
+  std::pair<f32, BasicOrthtree*> order[4];
+  int n = 0;
+  for (auto& c : *c) {
+    f32 t;
+    if (c.total && c.rect.intersect(o, inv, pad, t_max, t))
+      order[n++] = {t, &c};
+  }
+  std::sort(order, order + n,
+            [](auto& l, auto& r) { return l.first < r.first; });
+
+  for (int i = 0; i < n; i++) {
+    if (order[i].first > t_max)
+      break;
+    order[i].second->trace(o, inv, pad, t_max, f);
+  }
+}
+
+template <class Payload, class Policy>
+RayHit<Payload> BasicOrthtree<Payload, Policy>::raycast(vec2 origin,
+                                                        vec2 dir,
+                                                        f32 max_t,
+                                                        f32 radius)
+  requires Planar<Policy> {
+  RayHit<Payload> best = {0, max_t};
+  const vec2 inv = {1.f / dir.x, 1.f / dir.y};
+  f32 t;
+  if (!total || !rect.intersect(origin, inv, radius, max_t, t))
+    return best;
+
+  const f32 a = dot(dir, dir);
+  auto hit = [&](Items& b) {
+    for (auto& e : b) {
+      const vec2 m = origin - Policy::pos(context, e);
+      const f32 c = dot(m, m) - radius * radius;
+      if (c <= 0) {
+        best = {&e, 0};
+        continue;
+      }
+      // h * h - a * c cancels badly once the ray is long next to radius, so
+      // the discriminant is taken from the closest approach q instead.
+      const f32 h = dot(m, dir);
+      if (h >= 0)
+        continue;
+      const vec2 q = m - dir * (h / a);
+      const f32 disc = radius * radius - dot(q, q);
+      if (disc < 0)
+        continue;
+      const f32 te = -h / a - sqrtf(disc / a);
+      if (te <= best.t)
+        best = {&e, te};
+    }
+  };
+  trace(origin, inv, radius, best.t, hit);
+  return best;
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::segment_query(
+    vec2 a,
+    vec2 b,
+    f32 radius,
+    std::vector<Payload*>& collection)
+  requires Planar<Policy> {
+  const vec2 d = b - a;
+  const vec2 inv = {1.f / d.x, 1.f / d.y};
+  f32 t_max = 1, t;
+  if (!total || !rect.intersect(a, inv, radius, t_max, t))
+    return;
+
+  const f32 dd = dot(d, d);
+  const f32 rr = radius * radius;
+  auto near = [&](Items& b) {
+    for (auto& e : b) {
+      const vec2 m = Policy::pos(context, e) - a;
+      const f32 s = dd > 0 ? fminf(fmaxf(dot(m, d) / dd, 0.f), 1.f) : 0.f;
+      const vec2 v = m - d * s;
+      if (dot(v, v) <= rr)
+        collection.push_back(&e);
+    }
+  };
+  trace(a, inv, radius, t_max, near);
+}
+
+template <class Payload, class Policy>
+void BasicOrthtree<Payload, Policy>::nearest(
+    vt p,
+    u32 k,
+    std::vector<Payload*>& collection) {
+  if (!k || !total)
+    return;
+
+  using Open = std::pair<f32, BasicOrthtree*>;
+  using Hit = std::pair<f32, Payload*>;
+  auto closer = [](auto& l, auto& r) { return l.first > r.first; };
+  auto further = [](auto& l, auto& r) { return l.first < r.first; };
+
+  // Min-heap of cells to open, max-heap of the best k entities so far.
+  std::vector<Open> cells = {{rect.distance2(p), this}};
+  std::vector<Hit> best;
+  best.reserve(k);
+
+  while (!cells.empty()) {
+    std::pop_heap(cells.begin(), cells.end(), closer);
+    auto [d, q] = cells.back();
+    cells.pop_back();
+
+    if (best.size() == k && d >= best.front().first)
+      break;
+
+    if (auto c = q->leaf()) {
+      for (auto& e : *c) {
+        const vt v = Policy::pos(context, e) - p;
+        const f32 de = dot(v, v);
+        if (best.size() < k) {
+          best.push_back({de, &e});
+          std::push_heap(best.begin(), best.end(), further);
+        } else if (de < best.front().first) {
+          std::pop_heap(best.begin(), best.end(), further);
+          best.back() = {de, &e};
+          std::push_heap(best.begin(), best.end(), further);
+        }
+      }
+      continue;
+    }
+
+    if (auto c = q->split())
+      for (auto& c : *c) {
+        if (!c.total)
+          continue;
+        const f32 dc = c.rect.distance2(p);
+        if (best.size() < k || dc < best.front().first) {
+          cells.push_back({dc, &c});
+          std::push_heap(cells.begin(), cells.end(), closer);
+        }
+      }
+  }
+
+  std::sort_heap(best.begin(), best.end(), further);
+  for (auto& h : best)
+    collection.push_back(h.second);
+}
@@ -0,0 +1,88 @@
+#include "snapshot.h"
+
+using namespace std;
+
+void Snapshot::build(QuadTree& tree) {
+  nodes.clear();
+  items.clear();
+  items.reserve(tree.total);
+  nodes.push_back({});
+  copy(tree, 0);
+}
+
+// Children are reserved as a block before any of them is filled, which keeps
+// siblings adjacent. Indices rather than references are held across the
+// recursion because nodes may reallocate.
+void Snapshot::copy(QuadTree& q, u32 at) {
+  nodes[at].rect = q.rect;
+  nodes[at].kids = 0;
+  nodes[at].begin = items.size();
+
+  if (auto c = q.leaf()) {
+    items.insert(items.end(), c->begin(), c->end());
+  } else if (auto c = q.split()) {
+    const u32 k = nodes.size();
+    nodes.resize(k + 4);
+    nodes[at].kids = k;
+    for (u32 i = 0; i < 4; i++)
+      copy((*c)[i], k + i);
+  }
+
+  nodes[at].end = items.size();
+}
+
+void Snapshot::collect(vector<const TreeNode*>& collection) const {
+  for (auto& e : items)
+    collection.push_back(&e);
+}
+
+void Snapshot::find(Rect r, vector<const TreeNode*>& collection) const {
+  find(r, 0, collection);
+}
+
+void Snapshot::find(Rect r, u32 at, vector<const TreeNode*>& collection) const {
+  const Node& n = nodes[at];
+  if (n.begin == n.end)
+    return;
+
+  if (r.contains(n.rect)) {
+    for (u32 i = n.begin; i < n.end; i++)
+      collection.push_back(&items[i]);
+    return;
+  }
+
+  if (!r.overlaps(n.rect))
+    return;
+
+  if (!n.kids) {
+    for (u32 i = n.begin; i < n.end; i++)
+      if (r.contains(items[i].pos))
+        collection.push_back(&items[i]);
+    return;
+  }
+
+  for (u32 i = 0; i < 4; i++)
+    find(r, n.kids + i, collection);
+}
+
+void SnapshotCell::publish(QuadTree& tree, u64 stamp) {
+  shared_ptr<Snapshot> s = std::move(spare);
+  if (!s)
+    s = make_shared<Snapshot>();
+  s->build(tree);
+  s->stamp = stamp;
+
+  shared_ptr<const Snapshot> old = std::move(s);
+  {
+    lock_guard<mutex> l(m);
+    cur.swap(old);
+  }
+  // Once it is out of the cell no reader can pick the old snapshot up again,
+  // so a count of one means this is the last reference. use_count is a
+  // relaxed load; the fence pairs it with the releasing decrement of the last
+  // reader so its queries finish before the rebuild starts.
+  if (old.use_count() == 1) {
+    atomic_thread_fence(memory_order_acquire);
+    spare = const_pointer_cast<Snapshot>(old);
+  }
+}
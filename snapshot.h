@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "quadtree.h"
+
+// Read-only copy of a QuadTree laid out in two flat arrays. Entities are
+// stored in depth-first order, so every node owns one contiguous range of
+// them and a query that covers a whole node copies that range without going
+// further down. The four children of a node are adjacent in `nodes`.
+//
+// Nothing here is mutated after build, so any number of threads may query a
+// snapshot while the tree it came from keeps changing.
+struct Snapshot {
+  struct Node {
+    Rect rect;
+    // Index of the first child, or 0 for a leaf.
+    u32 kids;
+    u32 begin, end;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<TreeNode> items;
+  // Value passed to SnapshotCell::publish, usually the frame number.
+  u64 stamp = 0;
+
+  // Replaces the contents with a copy of tree, reusing the allocations.
+  void build(QuadTree& tree);
+  void copy(QuadTree& q, u32 at);
+
+  u32 count() const { return items.size(); }
+
+  void collect(std::vector<const TreeNode*>& collection) const;
+  void find(Rect r, std::vector<const TreeNode*>& collection) const;
+  void find(Rect r, u32 at, std::vector<const TreeNode*>& collection) const;
+};
+
+// Hands the latest snapshot to reader threads. The simulation thread calls
+// publish between frames, readers call get and keep the returned pointer for
+// as long as they query it. Reference counting retires old snapshots once
+// the last reader lets go; a retired snapshot nobody holds is rebuilt in
+// place by the next publish instead of being freed.
+//
+// The lock only covers copying or swapping the pointer, never a build or a
+// query, so readers do not wait for frames and the frame does not wait for
+// readers.
+struct SnapshotCell {
+  mutable std::mutex m;
+  std::shared_ptr<const Snapshot> cur;
+  std::shared_ptr<Snapshot> spare;
+
+  // Must only be called from one thread at a time.
+  void publish(QuadTree& tree, u64 stamp);
+
+  std::shared_ptr<const Snapshot> get() const {
+    std::lock_guard<std::mutex> l(m);
+    return cur;
+  }
+};
@@ -1,4 +1,8 @@
+#pragma once
+
+#include <math.h>
 #include <stdint.h>
+#include <string.h>
 #include <iosfwd>
 
 using f32 = float;